@@ -23,3 +23,22 @@ ufo_hdf5_can_open (const gchar *filename)
 
     return TRUE;
 }
+
+/*
+ * Stock builds of libhdf5 must not be called from several threads at once.
+ * Libraries too old to tell are assumed to be not thread-safe.
+ */
+gboolean
+ufo_hdf5_is_threadsafe (void)
+{
+#if H5_VERS_MAJOR > 1 || H5_VERS_MINOR > 8 || (H5_VERS_MINOR == 8 && H5_VERS_RELEASE >= 16)
+    hbool_t threadsafe = FALSE;
+
+    if (H5is_library_threadsafe (&threadsafe) < 0)
+        return FALSE;
+
+    return threadsafe ? TRUE : FALSE;
+#else
+    return FALSE;
+#endif
+}
@@ -12,5 +12,6 @@
 #include <hdf5.h>
 
 gboolean ufo_hdf5_can_open (const gchar *filename);
+gboolean ufo_hdf5_is_threadsafe (void);
 
 #endif
@@ -23,25 +23,55 @@ constant sampler_t volumeSampler = CLK_NORMALIZED_COORDS_FALSE |
 
 #define PI 3.1415926535897932384626433832795028841971693993751058209749445923078164062f
 
+/*
+ * With -DHALF_SINOGRAM the buffer kernels read sinograms stored as half
+ * floats, sums are still accumulated in single precision.
+ */
+#ifdef HALF_SINOGRAM
+#define SINOGRAM_TYPE half
+#define LOAD_SINOGRAM(p, i) vload_half ((i), (p))
+#else
+#define SINOGRAM_TYPE float
+#define LOAD_SINOGRAM(p, i) ((p)[i])
+#endif
+
+kernel void
+float_to_half (global const float *input,
+               global half *output)
+{
+    const size_t idx = get_global_id (0);
+
+    vstore_half (input[idx], idx, output);
+}
+
+/*
+ * Output pixel (idx, idy) is evaluated at x_offset + idx * step and
+ * y_offset + idy * step of the full slice, which selects a region of interest
+ * and binning. Outputs are stored compactly with the global size as width.
+ */
 kernel void
-backproject_nearest (global float *sinogram,
+backproject_nearest (global SINOGRAM_TYPE *sinogram,
                      global float *slice,
                      constant float *sin_lut,
                      constant float *cos_lut,
                      const unsigned int offset,
                      const unsigned n_projections,
-                     const float axis_pos)
+                     const float axis_pos,
+                     const unsigned int sinogram_width,
+                     const float x_offset,
+                     const float y_offset,
+                     const float step)
 {
     const int idx = get_global_id(0);
     const int idy = get_global_id(1);
     const int width = get_global_size(0);
-    const float bx = idx - axis_pos;
-    const float by = idy - axis_pos;
+    const float bx = x_offset + idx * step - axis_pos;
+    const float by = y_offset + idy * step - axis_pos;
     float sum = 0.0;
 
     for(int proj = 0; proj < n_projections; proj++) {
         float h = axis_pos + bx * cos_lut[offset + proj] + by * sin_lut[offset + proj];
-        sum += sinogram[(int)(proj * width + h)];
+        sum += LOAD_SINOGRAM (sinogram, (int)(proj * sinogram_width + h));
     }
 
     slice[idy * width + idx] = sum * 4.0 * PI;
@@ -54,13 +84,17 @@ backproject_tex (read_only image2d_t sinogram,
                  constant float *cos_lut,
                  const unsigned int offset,
                  const unsigned int n_projections,
-                 const float axis_pos)
+                 const float axis_pos,
+                 const unsigned int sinogram_width,
+                 const float x_offset,
+                 const float y_offset,
+                 const float step)
 {
     const int idx = get_global_id(0);
     const int idy = get_global_id(1);
     const int width = get_global_size(0);
-    const float bx = idx - axis_pos;
-    const float by = idy - axis_pos;
+    const float bx = x_offset + idx * step - axis_pos;
+    const float by = y_offset + idy * step - axis_pos;
     float sum = 0.0f;
 
     for(int proj = 0; proj < n_projections; proj++) {
@@ -75,3 +109,98 @@ backproject_tex (read_only image2d_t sinogram,
     slice[idy * width + idx] = sum * 4.0 * PI;
 }
 
+
+/*
+ * The multi-slice variants reconstruct a stack of sinograms sharing the same
+ * geometry. Each work item computes the detector position once per projection
+ * and accumulates SLICES_PER_ITEM slices along the third dimension. Reads for
+ * slices past the end of the stack are clamped to the last sinogram and their
+ * sums are discarded.
+ */
+#define SLICES_PER_ITEM 4
+
+kernel void
+backproject_nearest_multi (global SINOGRAM_TYPE *sinograms,
+                           global float *slices,
+                           constant float *sin_lut,
+                           constant float *cos_lut,
+                           const unsigned int offset,
+                           const unsigned n_projections,
+                           const float axis_pos,
+                           const unsigned int sinogram_width,
+                           const float x_offset,
+                           const float y_offset,
+                           const float step,
+                           const unsigned int n_slices)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int first = get_global_id(2) * SLICES_PER_ITEM;
+    const int width = get_global_size(0);
+    const size_t sinogram_size = sinogram_width * n_projections;
+    const size_t slice_size = width * get_global_size(1);
+    const float bx = x_offset + idx * step - axis_pos;
+    const float by = y_offset + idy * step - axis_pos;
+    /* Offsets rather than pointers, half pointers only support loads and stores */
+    const size_t o0 = min (first + 0, (int) n_slices - 1) * sinogram_size;
+    const size_t o1 = min (first + 1, (int) n_slices - 1) * sinogram_size;
+    const size_t o2 = min (first + 2, (int) n_slices - 1) * sinogram_size;
+    const size_t o3 = min (first + 3, (int) n_slices - 1) * sinogram_size;
+    float4 sum = (float4) (0.0f);
+
+    for(int proj = 0; proj < n_projections; proj++) {
+        float h = axis_pos + bx * cos_lut[offset + proj] + by * sin_lut[offset + proj];
+        int i = (int)(proj * sinogram_width + h);
+        sum += (float4) (LOAD_SINOGRAM (sinograms, o0 + i), LOAD_SINOGRAM (sinograms, o1 + i),
+                         LOAD_SINOGRAM (sinograms, o2 + i), LOAD_SINOGRAM (sinograms, o3 + i));
+    }
+
+    float sums[SLICES_PER_ITEM];
+    vstore4 (sum * 4.0f * PI, 0, sums);
+    slices += first * slice_size + idy * width + idx;
+
+    for (int k = 0; k < SLICES_PER_ITEM && first + k < n_slices; k++)
+        slices[k * slice_size] = sums[k];
+}
+
+kernel void
+backproject_tex_multi (read_only image3d_t sinograms,
+                       global float *slices,
+                       constant float *sin_lut,
+                       constant float *cos_lut,
+                       const unsigned int offset,
+                       const unsigned int n_projections,
+                       const float axis_pos,
+                       const unsigned int sinogram_width,
+                       const float x_offset,
+                       const float y_offset,
+                       const float step,
+                       const unsigned int n_slices)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int first = get_global_id(2) * SLICES_PER_ITEM;
+    const int width = get_global_size(0);
+    const size_t slice_size = width * get_global_size(1);
+    const float bx = x_offset + idx * step - axis_pos;
+    const float by = y_offset + idy * step - axis_pos;
+    const float4 z = convert_float4 (min ((int4) (first) + (int4) (0, 1, 2, 3), (int4) (n_slices - 1))) + 0.5f;
+    float4 sum = (float4) (0.0f);
+
+    for(int proj = 0; proj < n_projections; proj++) {
+        float h = by * sin_lut[offset + proj] + bx * cos_lut[offset + proj] + axis_pos;
+        float y = proj + 0.5f;
+        float4 val = (float4) (read_imagef (sinograms, volumeSampler, (float4) (h, y, z.x, 0.0f)).x,
+                               read_imagef (sinograms, volumeSampler, (float4) (h, y, z.y, 0.0f)).x,
+                               read_imagef (sinograms, volumeSampler, (float4) (h, y, z.z, 0.0f)).x,
+                               read_imagef (sinograms, volumeSampler, (float4) (h, y, z.w, 0.0f)).x);
+        sum += select (val, (float4) (0.0f), isnan (val));
+    }
+
+    float sums[SLICES_PER_ITEM];
+    vstore4 (sum * 4.0f * PI, 0, sums);
+    slices += first * slice_size + idy * width + idx;
+
+    for (int k = 0; k < SLICES_PER_ITEM && first + k < n_slices; k++)
+        slices[k * slice_size] = sums[k];
+}
@@ -56,3 +56,46 @@ forwardproject(read_only image2d_t slice,
 
     sinogram[idy * slice_width + idx] = sum;
 }
+
+/*
+ * Projects the rows of one ordered subset and returns the residual of the
+ * measured sinogram divided by the number of samples along each ray, which is
+ * the row sum of the projector. Pixel and detector centres lie at +0.5 like
+ * in backproject_tex, so the two are matched for iterative reconstruction.
+ * Row i of the subset is projection subset + i * n_subsets and its angle is
+ * stored at offset + i in the lookup tables.
+ */
+kernel void
+forwardproject_residual (read_only image2d_t slice,
+                         global const float *sinogram,
+                         global float *residual,
+                         constant float *sin_lut,
+                         constant float *cos_lut,
+                         const unsigned int offset,
+                         const unsigned int subset,
+                         const unsigned int n_subsets)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int slice_width = get_global_size(0);
+    const int proj = subset + idy * n_subsets;
+
+    const float r = slice_width / 2.0f;
+    const float d = idx + 0.5f - r;
+    const float l = sqrt(fmax(4.0f*r*r - 4.0f*d*d, 0.0f));
+    const int n_samples = (int) ceil(l);
+
+    const float2 D = (float2) (cos_lut[offset + idy], sin_lut[offset + idy]);
+    const float2 N = (float2) (D.y, -D.x);
+
+    float2 sample = d * D - l/2.0f * N + ((float2) (r + 0.5f, r + 0.5f));
+    float sum = 0.0f;
+
+    for (int i = 0; i < n_samples; i++) {
+        sum += read_imagef(slice, sampler, sample).x;
+        sample += N;
+    }
+
+    residual[idy * slice_width + idx] = n_samples > 0 ?
+        (sinogram[proj * slice_width + idx] - sum) / n_samples : 0.0f;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Reduce the per-item extrema of a work group, its size must be a power of two */
+void
+reduce_min_max (local float *scratch_min,
+                local float *scratch_max,
+                float cmin,
+                float cmax)
+{
+    const size_t lid = get_local_id (0);
+
+    scratch_min[lid] = cmin;
+    scratch_max[lid] = cmax;
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    for (size_t s = get_local_size (0) / 2; s > 0; s >>= 1) {
+        if (lid < s) {
+            scratch_min[lid] = fmin (scratch_min[lid], scratch_min[lid + s]);
+            scratch_max[lid] = fmax (scratch_max[lid], scratch_max[lid + s]);
+        }
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+kernel void
+minmax (global const float *input,
+        global float *partial,
+        local float *scratch_min,
+        local float *scratch_max,
+        const unsigned n)
+{
+    float cmin = INFINITY;
+    float cmax = -INFINITY;
+
+    for (size_t i = get_global_id (0); i < n; i += get_global_size (0)) {
+        cmin = fmin (cmin, input[i]);
+        cmax = fmax (cmax, input[i]);
+    }
+
+    reduce_min_max (scratch_min, scratch_max, cmin, cmax);
+
+    if (get_local_id (0) == 0) {
+        partial[2 * get_group_id (0)] = scratch_min[0];
+        partial[2 * get_group_id (0) + 1] = scratch_max[0];
+    }
+}
+
+/*
+ * Runs as a single work group. Like the host conversion, data that already
+ * fits into the output range is not stretched.
+ */
+kernel void
+minmax_final (global const float *partial,
+              global float *range,
+              local float *scratch_min,
+              local float *scratch_max,
+              const unsigned n_groups,
+              const float limit)
+{
+    float cmin = INFINITY;
+    float cmax = -INFINITY;
+
+    for (size_t i = get_local_id (0); i < n_groups; i += get_local_size (0)) {
+        cmin = fmin (cmin, partial[2 * i]);
+        cmax = fmax (cmax, partial[2 * i + 1]);
+    }
+
+    reduce_min_max (scratch_min, scratch_max, cmin, cmax);
+
+    if (get_local_id (0) == 0) {
+        cmin = scratch_min[0];
+        cmax = scratch_max[0];
+
+        if (cmin >= 0.0f && cmax <= limit) {
+            cmin = 0.0f;
+            cmax = limit;
+        }
+
+        range[0] = cmin;
+        range[1] = cmax;
+    }
+}
+
+/* fmax returns the other operand for NaN, which maps NaN to zero */
+uint
+scale_sample (float value, float min, float scale, float limit)
+{
+    return convert_uint (fmin (fmax ((value - min) * scale, 0.0f), limit));
+}
+
+/* Each item packs four samples into one little-endian word */
+kernel void
+quantize_8 (global const float *input,
+            global uint *output,
+            global const float *range,
+            const unsigned n)
+{
+    const size_t idx = get_global_id (0);
+    const float min = range[0];
+    const float scale = range[1] > min ? 255.0f / (range[1] - min) : 0.0f;
+    uint word = 0;
+
+    for (unsigned k = 0; k < 4; k++) {
+        const size_t i = 4 * idx + k;
+
+        if (i < n)
+            word |= scale_sample (input[i], min, scale, 255.0f) << (8 * k);
+    }
+
+    output[idx] = word;
+}
+
+/* Each item packs two samples into one little-endian word */
+kernel void
+quantize_16 (global const float *input,
+             global uint *output,
+             global const float *range,
+             const unsigned n)
+{
+    const size_t idx = get_global_id (0);
+    const float min = range[0];
+    const float scale = range[1] > min ? 65535.0f / (range[1] - min) : 0.0f;
+    uint word = 0;
+
+    for (unsigned k = 0; k < 2; k++) {
+        const size_t i = 2 * idx + k;
+
+        if (i < n)
+            word |= scale_sample (input[i], min, scale, 65535.0f) << (16 * k);
+    }
+
+    output[idx] = word;
+}
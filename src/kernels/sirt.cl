@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+kernel void
+sirt_clear (global float *slice)
+{
+    slice[get_global_id (0)] = 0.0f;
+}
+
+/*
+ * Adds the backprojected residual normalised by the column sums of the
+ * backprojector. Pixels no ray passes through are left untouched.
+ */
+kernel void
+sirt_update (global float *slice,
+             global const float *correction,
+             global const float *weights,
+             const float scale)
+{
+    const size_t idx = get_global_id (0);
+    const float weight = weights[idx];
+
+    if (weight > 0.0f)
+        slice[idx] += scale * correction[idx] / weight;
+}
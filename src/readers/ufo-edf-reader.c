@@ -17,19 +17,31 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "readers/ufo-reader.h"
 #include "readers/ufo-edf-reader.h"
 
 
-struct _UfoEdfReaderPrivate {
-    FILE *fp;
-    gssize size;
+typedef struct {
+    gsize offset;
+    gsize width;
     gsize height;
+    UfoBufferDepth depth;
     guint bytes_per_sample;
     gboolean big_endian;
+} EdfFrame;
+
+struct _UfoEdfReaderPrivate {
+    gchar *data;
+    gsize size;
+    GArray *frames;
+    guint current;
 };
 
 static void ufo_reader_interface_init (UfoReaderIface *iface);
@@ -54,39 +66,219 @@ ufo_edf_reader_can_open (UfoReader *reader,
     return g_str_has_suffix (filename, ".edf");
 }
 
+static void
+get_depth (const gchar *value, UfoBufferDepth *depth, guint *bytes)
+{
+    struct {
+        const gchar *name;
+        UfoBufferDepth depth;
+        guint bytes;
+    }
+    map[] = {
+        {"UnsignedShort",   UFO_BUFFER_DEPTH_16U, 2},
+        {"SignedInteger",   UFO_BUFFER_DEPTH_32S, 4},
+        {"UnsignedLong",    UFO_BUFFER_DEPTH_32U, 4},
+        {"Float",           UFO_BUFFER_DEPTH_32F, 4},
+        {"FloatValue",      UFO_BUFFER_DEPTH_32F, 4},
+        {NULL}
+    };
+
+    for (guint i = 0; map[i].name != NULL; i++) {
+        if (!g_strcmp0 (value, map[i].name)) {
+            *depth = map[i].depth;
+            *bytes = map[i].bytes;
+            return;
+        }
+    }
+
+    g_warning ("Unsupported data type");
+    *depth = UFO_BUFFER_DEPTH_8U;
+    *bytes = 1;
+}
+
+static void
+parse_header (const gchar *start, const gchar *end, EdfFrame *frame)
+{
+    const gchar *current = start;
+
+    frame->width = 0;
+    frame->height = 0;
+    frame->depth = UFO_BUFFER_DEPTH_8U;
+    frame->bytes_per_sample = 1;
+    frame->big_endian = FALSE;
+
+    while (current < end) {
+        const gchar *delimiter;
+        const gchar *equal;
+
+        delimiter = memchr (current, ';', end - current);
+
+        if (delimiter == NULL)
+            delimiter = end;
+
+        equal = memchr (current, '=', delimiter - current);
+
+        if (equal != NULL) {
+            gchar *key;
+            gchar *value;
+
+            key = g_strstrip (g_strndup (current, equal - current));
+            value = g_strstrip (g_strndup (equal + 1, delimiter - equal - 1));
+
+            if (!g_strcmp0 (key, "Dim_1"))
+                frame->width = (gsize) atoi (value);
+            else if (!g_strcmp0 (key, "Dim_2"))
+                frame->height = (gsize) atoi (value);
+            else if (!g_strcmp0 (key, "DataType"))
+                get_depth (value, &frame->depth, &frame->bytes_per_sample);
+            else if (!g_strcmp0 (key, "ByteOrder") && !g_strcmp0 (value, "HighByteFirst"))
+                frame->big_endian = TRUE;
+
+            g_free (key);
+            g_free (value);
+        }
+
+        current = delimiter + 1;
+    }
+}
+
+static void
+build_index (UfoEdfReaderPrivate *priv, const gchar *filename)
+{
+    gsize offset = 0;
+
+    /*
+     * A (multi) EDF file is a sequence of ASCII headers enclosed in curly
+     * braces, each immediately followed by the raw frame data. We walk the
+     * mapping once and remember where each frame starts, so that reading and
+     * skipping frames later on does not touch the headers again.
+     */
+    while (offset < priv->size) {
+        const gchar *header_end;
+        EdfFrame frame;
+        gsize frame_size;
+
+        if (priv->data[offset] != '{')
+            break;
+
+        header_end = memchr (priv->data + offset, '}', priv->size - offset);
+
+        if (header_end == NULL) {
+            g_warning ("edf: `%s' has an unterminated header", filename);
+            break;
+        }
+
+        parse_header (priv->data + offset + 1, header_end, &frame);
+
+        frame.offset = (gsize) (header_end - priv->data) + 1;
+
+        if (frame.offset < priv->size && priv->data[frame.offset] == '\n')
+            frame.offset++;
+
+        frame_size = frame.width * frame.height * frame.bytes_per_sample;
+
+        if (frame.offset + frame_size > priv->size) {
+            g_warning ("edf: `%s' is truncated", filename);
+            break;
+        }
+
+        g_array_append_val (priv->frames, frame);
+        offset = frame.offset + frame_size;
+    }
+}
+
 static void
 ufo_edf_reader_open (UfoReader *reader,
                      const gchar *filename)
 {
     UfoEdfReaderPrivate *priv;
-    
+    struct stat file_stat;
+    gint fd;
+
     priv = UFO_EDF_READER_GET_PRIVATE (reader);
-    priv->fp = fopen (filename, "rb");
+    priv->current = 0;
+    g_array_set_size (priv->frames, 0);
+
+    fd = open (filename, O_RDONLY);
 
-    fseek (priv->fp, 0L, SEEK_END);
-    priv->size = (gsize) ftell (priv->fp);
-    fseek (priv->fp, 0L, SEEK_SET);
+    if (fd < 0) {
+        g_warning ("edf: cannot open `%s'", filename);
+        return;
+    }
+
+    if (fstat (fd, &file_stat) < 0 || file_stat.st_size == 0) {
+        g_warning ("edf: cannot determine size of `%s'", filename);
+        close (fd);
+        return;
+    }
+
+    priv->size = (gsize) file_stat.st_size;
+    priv->data = mmap (NULL, priv->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping stays valid after the descriptor is closed */
+    close (fd);
+
+    if (priv->data == MAP_FAILED) {
+        g_warning ("edf: cannot map `%s'", filename);
+        priv->data = NULL;
+        priv->size = 0;
+        return;
+    }
+
+    build_index (priv, filename);
 }
 
 static void
 ufo_edf_reader_close (UfoReader *reader)
 {
     UfoEdfReaderPrivate *priv;
-    
+
     priv = UFO_EDF_READER_GET_PRIVATE (reader);
-    g_assert (priv->fp != NULL);
-    fclose (priv->fp);
-    priv->fp = NULL;
+
+    if (priv->data != NULL) {
+        munmap (priv->data, priv->size);
+        priv->data = NULL;
+    }
+
     priv->size = 0;
+    priv->current = 0;
+    g_array_set_size (priv->frames, 0);
 }
 
 static gboolean
 ufo_edf_reader_data_available (UfoReader *reader)
 {
     UfoEdfReaderPrivate *priv;
-    
+
+    priv = UFO_EDF_READER_GET_PRIVATE (reader);
+    return priv->data != NULL && priv->current < priv->frames->len;
+}
+
+static void
+ufo_edf_reader_skip (UfoReader *reader,
+                     guint n_frames)
+{
+    UfoEdfReaderPrivate *priv;
+
     priv = UFO_EDF_READER_GET_PRIVATE (reader);
-    return priv->fp != NULL && ftell (priv->fp) < priv->size;
+    priv->current = MIN (priv->current + n_frames, priv->frames->len);
+}
+
+static void
+swap_bytes (gpointer data, gsize n_pixels, guint bytes_per_sample)
+{
+    if (bytes_per_sample == 2) {
+        guint16 *conv = (guint16 *) data;
+
+        for (gsize i = 0; i < n_pixels; i++)
+            conv[i] = GUINT16_SWAP_LE_BE (conv[i]);
+    }
+    else if (bytes_per_sample == 4) {
+        guint32 *conv = (guint32 *) data;
+
+        for (gsize i = 0; i < n_pixels; i++)
+            conv[i] = GUINT32_SWAP_LE_BE (conv[i]);
+    }
 }
 
 static void
@@ -95,94 +287,36 @@ ufo_edf_reader_read (UfoReader *reader,
                      UfoRequisition *requisition,
                      guint roi_y,
                      guint roi_height,
-                     guint roi_step)
+                     guint roi_step,
+                     guint roi_x,
+                     guint roi_width,
+                     guint roi_x_step)
 {
     UfoEdfReaderPrivate *priv;
-    gsize num_bytes;
-    gsize num_read;
-    gssize offset;
+    EdfFrame *frame;
+    const gchar *src;
     gchar *data;
 
     priv = UFO_EDF_READER_GET_PRIVATE (reader);
+    frame = &g_array_index (priv->frames, EdfFrame, priv->current);
     data = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
 
     /* size of the image width in bytes */
-    const gsize width = requisition->dims[0] * priv->bytes_per_sample;
+    const gsize width = frame->width * frame->bytes_per_sample;
+    const guint num_columns = requisition->dims[0];
     const guint num_rows = requisition->dims[1];
-    const gsize end_position = ftell (priv->fp) + priv->height * width;
-
-    offset = 0;
 
-    /* Go to the first desired row */
-    fseek (priv->fp, roi_y * width, SEEK_CUR);
+    src = priv->data + frame->offset + roi_y * width + roi_x * frame->bytes_per_sample;
 
-    if (roi_step == 1) {
-        /* Read the full ROI at once if no stepping is specified */
-        num_bytes = width * roi_height;
-        num_read = fread (data, 1, num_bytes, priv->fp);
-
-        if (num_bytes != num_bytes)
-            return;
-    }
-    else {
-        for (guint i = 0; i < num_rows - 1; i++) {
-            num_read = fread (data + offset, 1, width, priv->fp);
-
-            if (num_read != width)
-                return;
-
-            offset += width;
-            fseek (priv->fp, (roi_step - 1) * width, SEEK_CUR);
-        }
-
-        /* Read the last row without moving the file pointer so that the fseek to
-         * the image end works properly */
-        num_read = fread (data + offset, 1, width, priv->fp);
-
-        if (num_read != width)
-            return;
-    }
-
-    /* Go to the image end to be in a consistent state for the next read */
-    fseek (priv->fp, end_position, SEEK_SET);
-
-    if ((G_BYTE_ORDER == G_LITTLE_ENDIAN) && priv->big_endian) {
-        guint32 *conv = (guint32 *) buffer;
-        guint n_pixels = requisition->dims[0] * requisition->dims[1];
-
-        for (guint i = 0; i < n_pixels; i++)
-            conv[i] = g_ntohl (conv[i]);
-    }
-}
-
-static void
-ufo_edf_reader_get_depth (const gchar *value, UfoBufferDepth *depth, guint *bytes)
-{
-    struct {
-        const gchar *name;
-        UfoBufferDepth depth;
-        guint bytes;
-    }
-    map[] = {
-        {"UnsignedShort",   UFO_BUFFER_DEPTH_16U, 2},
-        {"SignedInteger",   UFO_BUFFER_DEPTH_32S, 4},
-        {"UnsignedLong",    UFO_BUFFER_DEPTH_32U, 4},
-        {"Float",           UFO_BUFFER_DEPTH_32F, 4},
-        {"FloatValue",      UFO_BUFFER_DEPTH_32F, 4},
-        {NULL}
-    };
+    /* Only the selected rows and columns are copied out of the mapping */
+    ufo_reader_copy_region (data, num_columns * frame->bytes_per_sample,
+                            src, roi_step * width,
+                            num_rows, num_columns, roi_x_step, frame->bytes_per_sample);
 
-    for (guint i = 0; map[i].name != NULL; i++) {
-        if (!g_strcmp0 (value, map[i].name)) {
-            *depth = map[i].depth;
-            *bytes = map[i].bytes;
-            return;
-        }
-    }
+    if (frame->big_endian != (G_BYTE_ORDER == G_BIG_ENDIAN))
+        swap_bytes (data, num_columns * num_rows, frame->bytes_per_sample);
 
-    g_warning ("Unsupported data type");
-    *depth = UFO_BUFFER_DEPTH_8U;
-    *bytes = 1;
+    priv->current++;
 }
 
 static void
@@ -192,66 +326,28 @@ ufo_edf_reader_get_meta (UfoReader *reader,
                          UfoBufferDepth *bitdepth)
 {
     UfoEdfReaderPrivate *priv;
-    gchar **tokens;
-    gchar *header = g_malloc (1024);
+    EdfFrame *frame;
 
     priv = UFO_EDF_READER_GET_PRIVATE (reader);
+    g_assert (priv->current < priv->frames->len);
 
-    if (fread (header, 1, 1024, priv->fp) != 1024) {
-        g_free (header);
-        fclose (priv->fp);
-        priv->fp = NULL;
-        return;
-    }
-
-    tokens = g_strsplit (header, ";", 0);
-    priv->big_endian = FALSE;
-
-    for (guint i = 0; tokens[i] != NULL; i++) {
-        gchar **key_value;
-        gchar *key;
-        gchar *value;
-
-        key_value = g_strsplit (tokens[i], "=", 0);
-
-        if (key_value[0] == NULL || key_value[1] == NULL)
-            continue;
-
-        key = g_strstrip (key_value[0]);
-        value = g_strstrip (key_value[1]);
-
-        if (!g_strcmp0 (key, "Dim_1")) {
-            *width = (guint) atoi (value);
-        }
-        else if (!g_strcmp0 (key, "Dim_2")) {
-            *height = priv->height = atoi (value);
-        }
-        else if (!g_strcmp0 (key, "DataType")) {
-            ufo_edf_reader_get_depth (value, bitdepth, &priv->bytes_per_sample);
-        }
-        else if (!g_strcmp0 (key, "ByteOrder") &&
-                 !g_strcmp0 (value, "HighByteFirst")) {
-            priv->big_endian = TRUE;
-        }
-
-        g_strfreev (key_value);
-    }
-
-    g_strfreev (tokens);
-    g_free (header);
+    frame = &g_array_index (priv->frames, EdfFrame, priv->current);
+    *width = frame->width;
+    *height = frame->height;
+    *bitdepth = frame->depth;
 }
 
 static void
 ufo_edf_reader_finalize (GObject *object)
 {
     UfoEdfReaderPrivate *priv;
-    
+
     priv = UFO_EDF_READER_GET_PRIVATE (object);
 
-    if (priv->fp != NULL) {
-        fclose (priv->fp);
-        priv->fp = NULL;
-    }
+    if (priv->data != NULL)
+        ufo_edf_reader_close (UFO_READER (object));
+
+    g_array_free (priv->frames, TRUE);
 
     G_OBJECT_CLASS (ufo_edf_reader_parent_class)->finalize (object);
 }
@@ -263,6 +359,7 @@ ufo_reader_interface_init (UfoReaderIface *iface)
     iface->open = ufo_edf_reader_open;
     iface->close = ufo_edf_reader_close;
     iface->read = ufo_edf_reader_read;
+    iface->skip = ufo_edf_reader_skip;
     iface->get_meta = ufo_edf_reader_get_meta;
     iface->data_available = ufo_edf_reader_data_available;
 }
@@ -283,5 +380,8 @@ ufo_edf_reader_init (UfoEdfReader *self)
     UfoEdfReaderPrivate *priv = NULL;
 
     self->priv = priv = UFO_EDF_READER_GET_PRIVATE (self);
-    priv->fp = NULL;
+    priv->data = NULL;
+    priv->size = 0;
+    priv->current = 0;
+    priv->frames = g_array_new (FALSE, FALSE, sizeof (EdfFrame));
 }
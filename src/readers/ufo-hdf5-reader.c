@@ -17,6 +17,8 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "common/hdf5.h"
 #include "readers/ufo-reader.h"
 #include "readers/ufo-hdf5-reader.h"
@@ -30,6 +32,22 @@ struct _UfoHdf5ReaderPrivate {
     gint n_dims;
     hsize_t dims[3];
     guint current;
+
+    guint batch_size;
+    gsize chunk_cache_size;
+
+    /* Emit one sinogram per detector row instead of one frame per projection */
+    gboolean sinograms;
+    guint first_row;
+    guint n_rows;
+    guint row_step;
+    guint n_sinograms;
+
+    /* Frames [staged_first, staged_first + staged_count) read by the last batch */
+    gfloat *staging;
+    guint staged_first;
+    guint staged_count;
+    hsize_t staged_roi[6];
 };
 
 static void ufo_reader_interface_init (UfoReaderIface *iface);
@@ -53,6 +71,104 @@ ufo_hdf5_reader_can_open (UfoReader *reader,
     return ufo_hdf5_can_open (filename);
 }
 
+void
+ufo_hdf5_reader_set_batch_size (UfoHdf5Reader *reader,
+                                guint batch_size)
+{
+    reader->priv->batch_size = MAX (batch_size, 1);
+}
+
+void
+ufo_hdf5_reader_set_chunk_cache_size (UfoHdf5Reader *reader,
+                                      gsize chunk_cache_size)
+{
+    reader->priv->chunk_cache_size = chunk_cache_size;
+}
+
+void
+ufo_hdf5_reader_set_sinograms (UfoHdf5Reader *reader,
+                               gboolean sinograms,
+                               guint first_row,
+                               guint n_rows,
+                               guint row_step)
+{
+    reader->priv->sinograms = sinograms;
+    reader->priv->first_row = first_row;
+    reader->priv->n_rows = n_rows;
+    reader->priv->row_step = MAX (row_step, 1);
+}
+
+static guint
+get_num_items (UfoHdf5ReaderPrivate *priv)
+{
+    return priv->sinograms ? priv->n_sinograms : (guint) priv->dims[0];
+}
+
+static gsize
+next_prime (gsize n)
+{
+    for (;; n++) {
+        gboolean prime = n > 1;
+
+        for (gsize i = 2; i * i <= n && prime; i++)
+            prime = n % i != 0;
+
+        if (prime)
+            return n;
+    }
+}
+
+static hid_t
+create_access_plist (UfoHdf5ReaderPrivate *priv)
+{
+    hid_t dcpl;
+    hid_t dapl;
+    hid_t type_id;
+    hsize_t chunk_dims[3];
+    gsize n_chunks;
+    gsize n_bytes;
+
+    dapl = H5Pcreate (H5P_DATASET_ACCESS);
+    dcpl = H5Dget_create_plist (priv->dataset_id);
+
+    if (H5Pget_layout (dcpl) != H5D_CHUNKED || priv->n_dims != 3) {
+        H5Pclose (dcpl);
+        return dapl;
+    }
+
+    H5Pget_chunk (dcpl, 3, chunk_dims);
+    H5Pclose (dcpl);
+
+    type_id = H5Dget_type (priv->dataset_id);
+
+    /*
+     * Make room for all chunks touched by one batch of full frames (or rows of
+     * all projections), which may straddle one more chunk boundary along the
+     * batch axis than it spans.
+     */
+    if (priv->sinograms) {
+        n_chunks = ((priv->dims[0] + chunk_dims[0] - 1) / chunk_dims[0]) *
+                   ((priv->batch_size + chunk_dims[1] - 1) / chunk_dims[1] + 1) *
+                   ((priv->dims[2] + chunk_dims[2] - 1) / chunk_dims[2]);
+    }
+    else {
+        n_chunks = ((priv->batch_size + chunk_dims[0] - 1) / chunk_dims[0] + 1) *
+                   ((priv->dims[1] + chunk_dims[1] - 1) / chunk_dims[1]) *
+                   ((priv->dims[2] + chunk_dims[2] - 1) / chunk_dims[2]);
+    }
+
+    n_bytes = n_chunks * chunk_dims[0] * chunk_dims[1] * chunk_dims[2] * H5Tget_size (type_id);
+
+    if (priv->chunk_cache_size > 0)
+        n_bytes = priv->chunk_cache_size;
+
+    /* HDF5 recommends a prime number of slots about 100 times the number of chunks */
+    H5Pset_chunk_cache (dapl, next_prime (100 * n_chunks), n_bytes, 1.0);
+    H5Tclose (type_id);
+
+    return dapl;
+}
+
 static void
 ufo_hdf5_reader_open (UfoReader *reader,
                       const gchar *filename)
@@ -73,7 +189,8 @@ ufo_hdf5_reader_open (UfoReader *reader,
     h5_filename = components[0];
     h5_dataset = components[1];
 
-    priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+    /* Open read-only so that several pipelines can share the same file */
+    priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDONLY, H5P_DEFAULT);
     priv->dataset_id = H5Dopen (priv->file_id, h5_dataset, H5P_DEFAULT);
     priv->src_dataspace_id = H5Dget_space (priv->dataset_id);
     priv->n_dims = H5Sget_simple_extent_ndims (priv->src_dataspace_id);
@@ -83,7 +200,29 @@ ufo_hdf5_reader_open (UfoReader *reader,
 
     H5Sget_simple_extent_dims (priv->src_dataspace_id, priv->dims, NULL);
 
+    if (priv->sinograms) {
+        if (priv->first_row >= priv->dims[1]) {
+            g_warning ("read:hdf5: first sinogram row %u >= height %zu", priv->first_row, (gsize) priv->dims[1]);
+            priv->first_row = 0;
+        }
+
+        if (!priv->n_rows || priv->first_row + priv->n_rows > priv->dims[1])
+            priv->n_rows = priv->dims[1] - priv->first_row;
+
+        priv->n_sinograms = (priv->n_rows + priv->row_step - 1) / priv->row_step;
+    }
+
+    if (priv->batch_size > 1 || priv->chunk_cache_size > 0 || priv->sinograms) {
+        /* The chunk cache can only be set when opening the dataset */
+        hid_t dapl = create_access_plist (priv);
+
+        H5Dclose (priv->dataset_id);
+        priv->dataset_id = H5Dopen (priv->file_id, h5_dataset, dapl);
+        H5Pclose (dapl);
+    }
+
     priv->current = 0;
+    priv->staged_count = 0;
     g_strfreev (components);
 }
 
@@ -97,6 +236,10 @@ ufo_hdf5_reader_close (UfoReader *reader)
     H5Sclose (priv->src_dataspace_id);
     H5Dclose (priv->dataset_id);
     H5Fclose (priv->file_id);
+
+    g_free (priv->staging);
+    priv->staging = NULL;
+    priv->staged_count = 0;
 }
 
 static gboolean
@@ -106,7 +249,81 @@ ufo_hdf5_reader_data_available (UfoReader *reader)
 
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
 
-    return priv->current < priv->dims[0];
+    return priv->current < get_num_items (priv);
+}
+
+static void
+read_hyperslab (UfoHdf5ReaderPrivate *priv,
+                gpointer data,
+                hsize_t *offset,
+                hsize_t *stride,
+                hsize_t *count)
+{
+    hid_t dst_dataspace_id;
+
+    dst_dataspace_id = H5Screate_simple (3, count, NULL);
+
+    H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, stride, count, NULL);
+    H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, data);
+    H5Sclose (dst_dataspace_id);
+}
+
+static void
+read_frames (UfoHdf5ReaderPrivate *priv,
+             gpointer data,
+             guint first,
+             guint n_frames,
+             hsize_t *roi)
+{
+    hsize_t offset[3] = { first, roi[0], roi[3] };
+    hsize_t stride[3] = { 1, roi[2], roi[5] };
+    hsize_t count[3] = { n_frames, roi[1], roi[4] };
+
+    read_hyperslab (priv, data, offset, stride, count);
+}
+
+static void
+read_sinogram (UfoHdf5ReaderPrivate *priv,
+               gfloat *data,
+               hsize_t *roi)
+{
+    const gsize width = roi[4];
+    const gsize n_projections = priv->dims[0];
+    guint index;
+
+    if (priv->current < priv->staged_first ||
+        priv->current >= priv->staged_first + priv->staged_count ||
+        memcmp (roi, priv->staged_roi, 6 * sizeof (hsize_t))) {
+        priv->staged_first = priv->current;
+        priv->staged_count = MIN (priv->batch_size, priv->n_sinograms - priv->current);
+        memcpy (priv->staged_roi, roi, 6 * sizeof (hsize_t));
+
+        hsize_t offset[3] = { 0, priv->first_row + priv->current * priv->row_step, roi[3] };
+        hsize_t stride[3] = { 1, priv->row_step, roi[5] };
+        hsize_t count[3] = { n_projections, priv->staged_count, width };
+
+        /* A single sinogram is read in place, otherwise we stage a batch of rows */
+        if (priv->staged_count == 1) {
+            read_hyperslab (priv, data, offset, stride, count);
+            priv->staged_count = 0;
+            priv->current++;
+            return;
+        }
+
+        priv->staging = g_realloc (priv->staging, priv->batch_size * n_projections * width * sizeof (gfloat));
+        read_hyperslab (priv, priv->staging, offset, stride, count);
+    }
+
+    /* The staging buffer holds the rows of a batch for each projection */
+    index = priv->current - priv->staged_first;
+
+    for (gsize i = 0; i < n_projections; i++) {
+        memcpy (data + i * width,
+                priv->staging + (i * priv->staged_count + index) * width,
+                width * sizeof (gfloat));
+    }
+
+    priv->current++;
 }
 
 static void
@@ -115,30 +332,63 @@ ufo_hdf5_reader_read (UfoReader *reader,
                       UfoRequisition *requisition,
                       guint roi_y,
                       guint roi_height,
-                      guint roi_step)
+                      guint roi_step,
+                      guint roi_x,
+                      guint roi_width,
+                      guint roi_x_step)
 {
     UfoHdf5ReaderPrivate *priv;
     gpointer data;
-    hid_t dst_dataspace_id;
-    hsize_t dst_dims[2];
+    gsize frame_size;
 
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
     data = ufo_buffer_get_host_array (buffer, NULL);
 
-    hsize_t offset[3] = { priv->current, roi_y, 0 };
-    hsize_t count[3] = { 1, roi_height, requisition->dims[0] };
+    /* Rows and columns are selected by the hyperslab, HDF5 reads nothing else */
+    hsize_t roi[6] = { roi_y, requisition->dims[1], roi_step, roi_x, requisition->dims[0], roi_x_step };
 
-    dst_dims[0] = roi_height;
-    dst_dims[1] = requisition->dims[0];
-    dst_dataspace_id = H5Screate_simple (2, dst_dims, NULL);
+    if (priv->sinograms) {
+        read_sinogram (priv, data, roi);
+        return;
+    }
 
-    H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
-    H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, data);
-    H5Sclose (dst_dataspace_id);
+    if (priv->batch_size == 1) {
+        read_frames (priv, data, priv->current, 1, roi);
+        priv->current++;
+        return;
+    }
+
+    /*
+     * Read batch_size consecutive frames with a single H5Dread into the staging
+     * buffer and hand them out one by one.
+     */
+    frame_size = roi[1] * roi[4];
+
+    if (priv->current < priv->staged_first ||
+        priv->current >= priv->staged_first + priv->staged_count ||
+        memcmp (roi, priv->staged_roi, sizeof (roi))) {
+        priv->staged_first = priv->current;
+        priv->staged_count = MIN (priv->batch_size, priv->dims[0] - priv->current);
+        memcpy (priv->staged_roi, roi, sizeof (roi));
+
+        priv->staging = g_realloc (priv->staging, priv->batch_size * frame_size * sizeof (gfloat));
+        read_frames (priv, priv->staging, priv->staged_first, priv->staged_count, roi);
+    }
 
+    memcpy (data, priv->staging + (priv->current - priv->staged_first) * frame_size, frame_size * sizeof (gfloat));
     priv->current++;
 }
 
+static void
+ufo_hdf5_reader_skip (UfoReader *reader,
+                      guint n_frames)
+{
+    UfoHdf5ReaderPrivate *priv;
+
+    priv = UFO_HDF5_READER_GET_PRIVATE (reader);
+    priv->current = MIN (priv->current + n_frames, get_num_items (priv));
+}
+
 static void
 ufo_hdf5_reader_get_meta (UfoReader *reader,
                           gsize *width,
@@ -150,7 +400,7 @@ ufo_hdf5_reader_get_meta (UfoReader *reader,
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
 
     *width = priv->dims[2];
-    *height = priv->dims[1];
+    *height = priv->sinograms ? priv->dims[0] : priv->dims[1];
     *bitdepth = UFO_BUFFER_DEPTH_32F;
 }
 
@@ -161,18 +411,46 @@ ufo_reader_interface_init (UfoReaderIface *iface)
     iface->open = ufo_hdf5_reader_open;
     iface->close = ufo_hdf5_reader_close;
     iface->read = ufo_hdf5_reader_read;
+    iface->skip = ufo_hdf5_reader_skip;
     iface->get_meta = ufo_hdf5_reader_get_meta;
     iface->data_available = ufo_hdf5_reader_data_available;
 }
 
+static void
+ufo_hdf5_reader_finalize (GObject *object)
+{
+    UfoHdf5ReaderPrivate *priv;
+
+    priv = UFO_HDF5_READER_GET_PRIVATE (object);
+    g_free (priv->staging);
+
+    G_OBJECT_CLASS (ufo_hdf5_reader_parent_class)->finalize (object);
+}
+
 static void
 ufo_hdf5_reader_class_init(UfoHdf5ReaderClass *klass)
 {
-    g_type_class_add_private (G_OBJECT_CLASS (klass), sizeof (UfoHdf5ReaderPrivate));
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->finalize = ufo_hdf5_reader_finalize;
+
+    g_type_class_add_private (gobject_class, sizeof (UfoHdf5ReaderPrivate));
 }
 
 static void
 ufo_hdf5_reader_init (UfoHdf5Reader *self)
 {
-    self->priv = UFO_HDF5_READER_GET_PRIVATE (self);
+    UfoHdf5ReaderPrivate *priv = NULL;
+
+    self->priv = priv = UFO_HDF5_READER_GET_PRIVATE (self);
+    priv->batch_size = 1;
+    priv->chunk_cache_size = 0;
+    priv->staging = NULL;
+    priv->staged_first = 0;
+    priv->staged_count = 0;
+    priv->sinograms = FALSE;
+    priv->first_row = 0;
+    priv->n_rows = 0;
+    priv->row_step = 1;
+    priv->n_sinograms = 0;
 }
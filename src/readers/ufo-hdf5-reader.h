@@ -46,8 +46,17 @@ struct _UfoHdf5ReaderClass {
     GObjectClass parent_class;
 };
 
-UfoHdf5Reader  *ufo_hdf5_reader_new       (void);
-GType           ufo_hdf5_reader_get_type  (void);
+UfoHdf5Reader  *ufo_hdf5_reader_new                  (void);
+void            ufo_hdf5_reader_set_batch_size       (UfoHdf5Reader *reader,
+                                                      guint          batch_size);
+void            ufo_hdf5_reader_set_chunk_cache_size (UfoHdf5Reader *reader,
+                                                      gsize          chunk_cache_size);
+void            ufo_hdf5_reader_set_sinograms        (UfoHdf5Reader *reader,
+                                                      gboolean       sinograms,
+                                                      guint          first_row,
+                                                      guint          n_rows,
+                                                      guint          row_step);
+GType           ufo_hdf5_reader_get_type             (void);
 
 G_END_DECLS
 
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* madvise and its hints are not part of C99 */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "readers/ufo-reader.h"
+#include "readers/ufo-raw-reader.h"
+
+
+struct _UfoRawReaderPrivate {
+    gchar *data;
+    gsize size;
+    guint current;
+    guint n_frames;
+
+    gsize width;
+    gsize height;
+    gsize offset;
+    guint bytes_per_sample;
+    UfoBufferDepth depth;
+
+    gboolean sinograms;
+    guint first_row;
+    guint n_rows;
+    guint row_step;
+    guint n_sinograms;
+};
+
+static void ufo_reader_interface_init (UfoReaderIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UfoRawReader, ufo_raw_reader, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_READER,
+                                                ufo_reader_interface_init))
+
+#define UFO_RAW_READER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_RAW_READER, UfoRawReaderPrivate))
+
+UfoRawReader *
+ufo_raw_reader_new (void)
+{
+    UfoRawReader *reader = g_object_new (UFO_TYPE_RAW_READER, NULL);
+    return reader;
+}
+
+void
+ufo_raw_reader_set_geometry (UfoRawReader *reader,
+                             gsize width,
+                             gsize height,
+                             guint bitdepth,
+                             gsize offset)
+{
+    UfoRawReaderPrivate *priv;
+
+    priv = reader->priv;
+    priv->width = width;
+    priv->height = height;
+    priv->offset = offset;
+
+    switch (bitdepth) {
+        case 8:
+            priv->depth = UFO_BUFFER_DEPTH_8U;
+            priv->bytes_per_sample = 1;
+            break;
+        case 16:
+            priv->depth = UFO_BUFFER_DEPTH_16U;
+            priv->bytes_per_sample = 2;
+            break;
+        default:
+            priv->depth = UFO_BUFFER_DEPTH_32F;
+            priv->bytes_per_sample = 4;
+    }
+}
+
+void
+ufo_raw_reader_set_sinograms (UfoRawReader *reader,
+                              gboolean sinograms,
+                              guint first_row,
+                              guint n_rows,
+                              guint row_step)
+{
+    reader->priv->sinograms = sinograms;
+    reader->priv->first_row = first_row;
+    reader->priv->n_rows = n_rows;
+    reader->priv->row_step = MAX (row_step, 1);
+}
+
+static gboolean
+ufo_raw_reader_can_open (UfoReader *reader,
+                         const gchar *filename)
+{
+    return g_str_has_suffix (filename, ".raw");
+}
+
+static void
+ufo_raw_reader_open (UfoReader *reader,
+                     const gchar *filename)
+{
+    UfoRawReaderPrivate *priv;
+    struct stat file_stat;
+    gsize frame_size;
+    gint fd;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    priv->current = 0;
+    priv->n_frames = 0;
+    frame_size = priv->width * priv->height * priv->bytes_per_sample;
+
+    if (frame_size == 0) {
+        g_warning ("raw: width and height of `%s' are unknown", filename);
+        return;
+    }
+
+    fd = open (filename, O_RDONLY);
+
+    if (fd < 0) {
+        g_warning ("raw: cannot open `%s'", filename);
+        return;
+    }
+
+    if (fstat (fd, &file_stat) < 0 || (gsize) file_stat.st_size < priv->offset + frame_size) {
+        g_warning ("raw: `%s' does not contain a single frame", filename);
+        close (fd);
+        return;
+    }
+
+    priv->size = (gsize) file_stat.st_size;
+    priv->data = mmap (NULL, priv->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping stays valid after the descriptor is closed */
+    close (fd);
+
+    if (priv->data == MAP_FAILED) {
+        g_warning ("raw: cannot map `%s'", filename);
+        priv->data = NULL;
+        priv->size = 0;
+        return;
+    }
+
+    priv->n_frames = (priv->size - priv->offset) / frame_size;
+
+    if (priv->sinograms) {
+        if (priv->first_row >= priv->height) {
+            g_warning ("raw: first sinogram row %u >= height %zu", priv->first_row, priv->height);
+            priv->first_row = 0;
+        }
+
+        if (!priv->n_rows || priv->first_row + priv->n_rows > priv->height)
+            priv->n_rows = priv->height - priv->first_row;
+
+        priv->n_sinograms = (priv->n_rows + priv->row_step - 1) / priv->row_step;
+
+        /* Sinograms gather one row from every frame, so no read-ahead */
+        madvise (priv->data, priv->size, MADV_NORMAL);
+    }
+    else {
+        madvise (priv->data, priv->size, MADV_SEQUENTIAL);
+    }
+}
+
+static void
+ufo_raw_reader_close (UfoReader *reader)
+{
+    UfoRawReaderPrivate *priv;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (reader);
+
+    if (priv->data != NULL) {
+        munmap (priv->data, priv->size);
+        priv->data = NULL;
+    }
+
+    priv->size = 0;
+    priv->current = 0;
+    priv->n_frames = 0;
+}
+
+static guint
+get_num_items (UfoRawReaderPrivate *priv)
+{
+    return priv->sinograms ? priv->n_sinograms : priv->n_frames;
+}
+
+static gboolean
+ufo_raw_reader_data_available (UfoReader *reader)
+{
+    UfoRawReaderPrivate *priv;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    return priv->data != NULL && priv->current < get_num_items (priv);
+}
+
+static void
+ufo_raw_reader_skip (UfoReader *reader,
+                     guint n_frames)
+{
+    UfoRawReaderPrivate *priv;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    priv->current = MIN (priv->current + n_frames, get_num_items (priv));
+}
+
+static void
+ufo_raw_reader_read (UfoReader *reader,
+                     UfoBuffer *buffer,
+                     UfoRequisition *requisition,
+                     guint roi_y,
+                     guint roi_height,
+                     guint roi_step,
+                     guint roi_x,
+                     guint roi_width,
+                     guint roi_x_step)
+{
+    UfoRawReaderPrivate *priv;
+    const gchar *src;
+    gchar *data;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    data = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
+
+    /* size of the image width in bytes */
+    const gsize width = priv->width * priv->bytes_per_sample;
+    const gsize frame_size = width * priv->height;
+    const guint num_columns = requisition->dims[0];
+    const guint num_rows = requisition->dims[1];
+
+    if (priv->sinograms) {
+        /* Row i of the sinogram is the selected detector row of frame i */
+        src = priv->data + priv->offset + (priv->first_row + priv->current * priv->row_step) * width;
+        src += roi_x * priv->bytes_per_sample;
+
+        ufo_reader_copy_region (data, num_columns * priv->bytes_per_sample,
+                                src, frame_size,
+                                num_rows, num_columns, roi_x_step, priv->bytes_per_sample);
+    }
+    else {
+        src = priv->data + priv->offset + priv->current * frame_size + roi_y * width;
+        src += roi_x * priv->bytes_per_sample;
+
+        ufo_reader_copy_region (data, num_columns * priv->bytes_per_sample,
+                                src, roi_step * width,
+                                num_rows, num_columns, roi_x_step, priv->bytes_per_sample);
+    }
+
+    priv->current++;
+}
+
+static void
+ufo_raw_reader_get_meta (UfoReader *reader,
+                         gsize *width,
+                         gsize *height,
+                         UfoBufferDepth *bitdepth)
+{
+    UfoRawReaderPrivate *priv;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    *width = priv->width;
+    *height = priv->sinograms ? priv->n_frames : priv->height;
+    *bitdepth = priv->depth;
+}
+
+static void
+ufo_raw_reader_finalize (GObject *object)
+{
+    UfoRawReaderPrivate *priv;
+
+    priv = UFO_RAW_READER_GET_PRIVATE (object);
+
+    if (priv->data != NULL)
+        ufo_raw_reader_close (UFO_READER (object));
+
+    G_OBJECT_CLASS (ufo_raw_reader_parent_class)->finalize (object);
+}
+
+static void
+ufo_reader_interface_init (UfoReaderIface *iface)
+{
+    iface->can_open = ufo_raw_reader_can_open;
+    iface->open = ufo_raw_reader_open;
+    iface->close = ufo_raw_reader_close;
+    iface->read = ufo_raw_reader_read;
+    iface->skip = ufo_raw_reader_skip;
+    iface->get_meta = ufo_raw_reader_get_meta;
+    iface->data_available = ufo_raw_reader_data_available;
+}
+
+static void
+ufo_raw_reader_class_init (UfoRawReaderClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->finalize = ufo_raw_reader_finalize;
+
+    g_type_class_add_private (gobject_class, sizeof (UfoRawReaderPrivate));
+}
+
+static void
+ufo_raw_reader_init (UfoRawReader *self)
+{
+    UfoRawReaderPrivate *priv = NULL;
+
+    self->priv = priv = UFO_RAW_READER_GET_PRIVATE (self);
+    priv->data = NULL;
+    priv->size = 0;
+    priv->current = 0;
+    priv->n_frames = 0;
+    priv->width = 0;
+    priv->height = 0;
+    priv->offset = 0;
+    priv->bytes_per_sample = 4;
+    priv->depth = UFO_BUFFER_DEPTH_32F;
+    priv->sinograms = FALSE;
+    priv->first_row = 0;
+    priv->n_rows = 0;
+    priv->row_step = 1;
+    priv->n_sinograms = 0;
+}
@@ -17,6 +17,8 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "ufo-reader.h"
 
 typedef UfoReaderIface UfoReaderInterface;
@@ -65,9 +67,76 @@ ufo_reader_read (UfoReader *reader,
                  UfoRequisition *requisition,
                  guint roi_y,
                  guint roi_height,
-                 guint roi_step)
+                 guint roi_step,
+                 guint roi_x,
+                 guint roi_width,
+                 guint roi_x_step)
+{
+    UFO_READER_GET_IFACE (reader)->read (reader, buffer, requisition,
+                                         roi_y, roi_height, roi_step,
+                                         roi_x, roi_width, roi_x_step);
+}
+
+gboolean
+ufo_reader_skip (UfoReader *reader,
+                 guint n_frames)
 {
-    UFO_READER_GET_IFACE (reader)->read (reader, buffer, requisition, roi_y, roi_height, roi_step);
+    UfoReaderIface *iface;
+
+    iface = UFO_READER_GET_IFACE (reader);
+
+    if (iface->skip == NULL)
+        return FALSE;
+
+    iface->skip (reader, n_frames);
+    return TRUE;
+}
+
+/**
+ * ufo_reader_copy_region:
+ * @dst: Destination of the first row
+ * @dst_stride: Bytes between consecutive destination rows
+ * @src: First sample of the first source row
+ * @src_stride: Bytes between consecutive source rows
+ * @n_rows: Number of rows to copy
+ * @n_columns: Number of samples to copy per row
+ * @column_step: Distance between copied source samples
+ * @bytes_per_sample: Size of a single sample
+ *
+ * Copy a rectangular, possibly strided region of samples as used by readers
+ * that access their data in memory.
+ */
+void
+ufo_reader_copy_region (gchar *dst,
+                        gsize dst_stride,
+                        const gchar *src,
+                        gsize src_stride,
+                        guint n_rows,
+                        guint n_columns,
+                        guint column_step,
+                        gsize bytes_per_sample)
+{
+    const gsize row_size = n_columns * bytes_per_sample;
+
+    if (column_step == 1) {
+        if (dst_stride == row_size && src_stride == row_size) {
+            memcpy (dst, src, row_size * n_rows);
+            return;
+        }
+
+        for (guint i = 0; i < n_rows; i++)
+            memcpy (dst + i * dst_stride, src + i * src_stride, row_size);
+
+        return;
+    }
+
+    for (guint i = 0; i < n_rows; i++) {
+        gchar *d = dst + i * dst_stride;
+        const gchar *s = src + i * src_stride;
+
+        for (guint j = 0; j < n_columns; j++)
+            memcpy (d + j * bytes_per_sample, s + j * column_step * bytes_per_sample, bytes_per_sample);
+    }
 }
 
 static void
@@ -53,7 +53,12 @@ struct _UfoReaderIface {
                                          UfoRequisition *requisition,
                                          guint           roi_y,
                                          guint           roi_height,
-                                         guint           roi_step);
+                                         guint           roi_step,
+                                         guint           roi_x,
+                                         guint           roi_width,
+                                         guint           roi_x_step);
+    void        (*skip)                 (UfoReader      *reader,
+                                         guint           n_frames);
 };
 
 gboolean    ufo_reader_can_open         (UfoReader      *reader,
@@ -71,7 +76,20 @@ void        ufo_reader_read             (UfoReader      *reader,
                                          UfoRequisition *requisition,
                                          guint           roi_y,
                                          guint           roi_height,
-                                         guint           roi_step);
+                                         guint           roi_step,
+                                         guint           roi_x,
+                                         guint           roi_width,
+                                         guint           roi_x_step);
+gboolean    ufo_reader_skip             (UfoReader      *reader,
+                                         guint           n_frames);
+void        ufo_reader_copy_region      (gchar          *dst,
+                                         gsize           dst_stride,
+                                         const gchar    *src,
+                                         gsize           src_stride,
+                                         guint           n_rows,
+                                         guint           n_columns,
+                                         guint           column_step,
+                                         gsize           bytes_per_sample);
 
 GType  ufo_reader_get_type        (void);
 
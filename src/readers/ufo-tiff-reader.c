@@ -17,15 +17,33 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <tiffio.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "readers/ufo-reader.h"
 #include "readers/ufo-tiff-reader.h"
 
 
+typedef struct {
+    guint32 x;
+    guint32 y;
+    guint32 width;
+    guint32 height;
+    guint32 index;
+} Chunk;
+
 struct _UfoTiffReaderPrivate {
     TIFF    *tiff;
     gboolean more;
+    gchar   *filename;
+
+    /* Additional handles on the same file for parallel decoding */
+    TIFF   **thread_tiffs;
+    gint     n_threads;
 };
 
 static void ufo_reader_interface_init (UfoReaderIface *iface);
@@ -59,6 +77,9 @@ ufo_tiff_reader_open (UfoReader *reader,
     priv = UFO_TIFF_READER_GET_PRIVATE (reader);
     priv->tiff = TIFFOpen (filename, "r");
     priv->more = TRUE;
+
+    g_free (priv->filename);
+    priv->filename = g_strdup (filename);
 }
 
 static void
@@ -70,6 +91,13 @@ ufo_tiff_reader_close (UfoReader *reader)
     g_assert (priv->tiff != NULL);
     TIFFClose (priv->tiff);
     priv->tiff = NULL;
+
+    for (gint i = 0; i < priv->n_threads; i++) {
+        if (priv->thread_tiffs[i] != NULL) {
+            TIFFClose (priv->thread_tiffs[i]);
+            priv->thread_tiffs[i] = NULL;
+        }
+    }
 }
 
 static gboolean
@@ -82,42 +110,219 @@ ufo_tiff_reader_data_available (UfoReader *reader)
     return priv->more && priv->tiff != NULL;
 }
 
+static TIFF *
+get_thread_tiff (UfoTiffReaderPrivate *priv, gint thread)
+{
+    TIFF *tiff;
+    guint16 directory;
+
+    /* The main handle is positioned on the current directory already */
+    if (thread == 0)
+        return priv->tiff;
+
+    directory = TIFFCurrentDirectory (priv->tiff);
+    tiff = priv->thread_tiffs[thread];
+
+    if (tiff == NULL) {
+        tiff = priv->thread_tiffs[thread] = TIFFOpen (priv->filename, "r");
+
+        if (tiff == NULL)
+            return NULL;
+    }
+
+    /* Avoid walking the directory chain from the start for sequential reads */
+    if (TIFFCurrentDirectory (tiff) + 1 == directory)
+        TIFFReadDirectory (tiff);
+    else if (TIFFCurrentDirectory (tiff) != directory)
+        TIFFSetDirectory (tiff, directory);
+
+    return tiff;
+}
+
+static GArray *
+get_chunks (TIFF *tiff, guint32 width, guint32 height, guint roi_y, guint roi_height, guint roi_x, guint roi_width)
+{
+    GArray *chunks;
+    guint32 chunk_width;
+    guint32 chunk_height;
+    gboolean tiled;
+
+    chunks = g_array_new (FALSE, FALSE, sizeof (Chunk));
+    tiled = TIFFIsTiled (tiff);
+
+    if (tiled) {
+        TIFFGetField (tiff, TIFFTAG_TILEWIDTH, &chunk_width);
+        TIFFGetField (tiff, TIFFTAG_TILELENGTH, &chunk_height);
+    }
+    else {
+        chunk_width = width;
+        TIFFGetFieldDefaulted (tiff, TIFFTAG_ROWSPERSTRIP, &chunk_height);
+        chunk_height = MIN (chunk_height, height);
+    }
+
+    /* Only consider strips and tiles that intersect the ROI */
+    for (guint32 y = (roi_y / chunk_height) * chunk_height; y < roi_y + roi_height; y += chunk_height) {
+        for (guint32 x = (roi_x / chunk_width) * chunk_width; x < roi_x + roi_width; x += chunk_width) {
+            Chunk chunk;
+
+            chunk.x = x;
+            chunk.y = y;
+            chunk.width = MIN (chunk_width, width - x);
+            chunk.height = MIN (chunk_height, height - y);
+            chunk.index = tiled ? TIFFComputeTile (tiff, x, y, 0, 0) : TIFFComputeStrip (tiff, y, 0);
+            g_array_append_val (chunks, chunk);
+        }
+    }
+
+    return chunks;
+}
+
 static void
 ufo_tiff_reader_read (UfoReader *reader,
                       UfoBuffer *buffer,
                       UfoRequisition *requisition,
                       guint roi_y,
                       guint roi_height,
-                      guint roi_step)
+                      guint roi_step,
+                      guint roi_x,
+                      guint roi_width,
+                      guint roi_x_step)
 {
     UfoTiffReaderPrivate *priv;
+    GArray *chunks;
     gchar *data;
-    tsize_t result;
-    gsize offset;
+    guint32 width;
+    guint32 height;
     guint16 bits;
-    gsize step;
+    guint16 compression;
+    gboolean tiled;
+    gsize chunk_size;
+    gsize chunk_stride;
+    gsize stride;
+    gsize bytes_per_sample;
+    gboolean full_width;
+    gint n_threads;
 
     priv = UFO_TIFF_READER_GET_PRIVATE (reader);
 
+    TIFFGetField (priv->tiff, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField (priv->tiff, TIFFTAG_IMAGELENGTH, &height);
     TIFFGetField (priv->tiff, TIFFTAG_BITSPERSAMPLE, &bits);
-    step = requisition->dims[0] * bits / 8;
+    TIFFGetFieldDefaulted (priv->tiff, TIFFTAG_COMPRESSION, &compression);
+
+    tiled = TIFFIsTiled (priv->tiff);
+    chunk_size = (gsize) (tiled ? TIFFTileSize (priv->tiff) : TIFFStripSize (priv->tiff));
+    bytes_per_sample = bits / 8;
+    stride = requisition->dims[0] * bytes_per_sample;
+    full_width = roi_x == 0 && roi_x_step == 1 && requisition->dims[0] == width;
+    /* Strips always span the whole image width, not just the output ROI */
+    chunk_stride = tiled ? (gsize) TIFFTileRowSize (priv->tiff) : width * bytes_per_sample;
     data = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
-    offset = 0;
-
-    for (guint i = roi_y; i < roi_y + roi_height; i += roi_step) {
-        result = TIFFReadScanline (priv->tiff, data + offset, i, 0);
-
-        if (result == -1) {
-            g_warning ("Cannot read scanline");
-            return;
+    chunks = get_chunks (priv->tiff, width, height, roi_y, roi_height, roi_x, roi_width);
+    n_threads = MAX (1, MIN (priv->n_threads, (gint) chunks->len));
+
+    /*
+     * Decoding compressed strips and tiles is expensive, so we spread them
+     * across threads that each use their own handle on the file. Uncompressed
+     * data is bound by I/O and read with the main handle only.
+     */
+#pragma omp parallel num_threads(n_threads) if (compression != COMPRESSION_NONE && chunks->len > 1)
+    {
+#ifdef _OPENMP
+        TIFF *tiff = get_thread_tiff (priv, omp_get_thread_num ());
+#else
+        TIFF *tiff = get_thread_tiff (priv, 0);
+#endif
+        gchar *scratch = g_malloc (chunk_size);
+
+#pragma omp for schedule(dynamic)
+        for (guint i = 0; i < chunks->len; i++) {
+            Chunk *chunk = &g_array_index (chunks, Chunk, i);
+            gboolean direct;
+            gchar *dst;
+            guint32 first_x;
+            guint32 end_x;
+            guint column;
+            guint num_columns;
+            tmsize_t result;
+
+            /*
+             * Whole-width strips that lie completely inside a contiguous ROI
+             * are decoded straight into the host array.
+             */
+            direct = !tiled && full_width && roi_step == 1 && chunk->y >= roi_y &&
+                     chunk->y + chunk->height <= roi_y + roi_height;
+
+            dst = direct ? data + (chunk->y - roi_y) * stride : scratch;
+
+            if (tiff == NULL)
+                result = -1;
+            else if (tiled)
+                result = TIFFReadEncodedTile (tiff, chunk->index, dst, (tmsize_t) chunk_size);
+            else if (direct)
+                result = TIFFReadEncodedStrip (tiff, chunk->index, dst, (tmsize_t) (chunk->height * stride));
+            else
+                result = TIFFReadEncodedStrip (tiff, chunk->index, dst, (tmsize_t) chunk_size);
+
+            if (result == -1) {
+                g_warning ("Cannot read %s %u", tiled ? "tile" : "strip", chunk->index);
+                continue;
+            }
+
+            if (direct)
+                continue;
+
+            /* First column of the chunk that lies on the horizontal step grid */
+            first_x = MAX (chunk->x, roi_x);
+            first_x = roi_x + ((first_x - roi_x + roi_x_step - 1) / roi_x_step) * roi_x_step;
+            end_x = MIN (chunk->x + chunk->width, roi_x + roi_width);
+
+            if (first_x >= end_x)
+                continue;
+
+            column = (first_x - roi_x) / roi_x_step;
+
+            if (column >= requisition->dims[0])
+                continue;
+
+            num_columns = MIN ((end_x - first_x + roi_x_step - 1) / roi_x_step, requisition->dims[0] - column);
+
+            for (guint32 y = chunk->y; y < chunk->y + chunk->height; y++) {
+                gsize row;
+
+                if (y < roi_y || y >= roi_y + roi_height || (y - roi_y) % roi_step)
+                    continue;
+
+                row = (y - roi_y) / roi_step;
+
+                if (row >= requisition->dims[1])
+                    break;
+
+                ufo_reader_copy_region (data + row * stride + column * bytes_per_sample, 0,
+                                        scratch + (y - chunk->y) * chunk_stride + (first_x - chunk->x) * bytes_per_sample, 0,
+                                        1, num_columns, roi_x_step, bytes_per_sample);
+            }
         }
 
-        offset += step;
+        g_free (scratch);
     }
 
+    g_array_free (chunks, TRUE);
     priv->more = TIFFReadDirectory (priv->tiff) == 1;
 }
 
+static void
+ufo_tiff_reader_skip (UfoReader *reader,
+                      guint n_frames)
+{
+    UfoTiffReaderPrivate *priv;
+
+    priv = UFO_TIFF_READER_GET_PRIVATE (reader);
+
+    if (priv->more && n_frames > 0)
+        priv->more = TIFFSetDirectory (priv->tiff, TIFFCurrentDirectory (priv->tiff) + n_frames) == 1;
+}
+
 static void
 ufo_tiff_reader_get_meta (UfoReader *reader,
                           gsize *width,
@@ -161,6 +366,9 @@ ufo_tiff_reader_finalize (GObject *object)
     if (priv->tiff != NULL)
         ufo_tiff_reader_close (UFO_READER (object));
 
+    g_free (priv->thread_tiffs);
+    g_free (priv->filename);
+
     G_OBJECT_CLASS (ufo_tiff_reader_parent_class)->finalize (object);
 }
 
@@ -171,6 +379,7 @@ ufo_reader_interface_init (UfoReaderIface *iface)
     iface->open = ufo_tiff_reader_open;
     iface->close = ufo_tiff_reader_close;
     iface->read = ufo_tiff_reader_read;
+    iface->skip = ufo_tiff_reader_skip;
     iface->get_meta = ufo_tiff_reader_get_meta;
     iface->data_available = ufo_tiff_reader_data_available;
 }
@@ -193,4 +402,13 @@ ufo_tiff_reader_init (UfoTiffReader *self)
     self->priv = priv = UFO_TIFF_READER_GET_PRIVATE (self);
     priv->tiff = NULL;
     priv->more = FALSE;
+    priv->filename = NULL;
+
+#ifdef _OPENMP
+    priv->n_threads = omp_get_max_threads ();
+#else
+    priv->n_threads = 1;
+#endif
+
+    priv->thread_tiffs = g_new0 (TIFF *, priv->n_threads);
 }
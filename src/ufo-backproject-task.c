@@ -23,19 +23,37 @@
 #include <CL/cl.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <math.h>
+#include <string.h>
 #include "ufo-backproject-task.h"
 
+/* Must match the kernel, each work item reconstructs this many slices */
+#define SLICES_PER_ITEM 4
+
+/* Edge length of the output tiles reconstructed by one CPU thread */
+#define TILE_SIZE 32
 
 typedef enum {
     MODE_NEAREST,
-    MODE_TEXTURE
+    MODE_TEXTURE,
+    MODE_CPU
 } Mode;
 
 struct _UfoBackprojectTaskPrivate {
     cl_context context;
     cl_kernel nearest_kernel;
     cl_kernel texture_kernel;
+    cl_kernel nearest_multi_kernel;
+    cl_kernel texture_multi_kernel;
+    cl_kernel half_kernel;
+    cl_mem half_mem;
+    cl_mem half_image;
+    UfoRequisition half_req;
+    gboolean half_precision;
     cl_mem sin_lut;
     cl_mem cos_lut;
     gfloat *host_sin_lut;
@@ -48,6 +66,14 @@ struct _UfoBackprojectTaskPrivate {
     guint offset;
     guint burst_projections;
     guint n_projections;
+    guint roi_x;
+    guint roi_y;
+    guint roi_width;
+    guint roi_height;
+    guint binning;
+    guint sinogram_width;
+    gfloat x_offset;
+    gfloat y_offset;
     Mode mode;
 };
 
@@ -67,6 +93,12 @@ enum {
     PROP_ANGLE_STEP,
     PROP_ANGLE_OFFSET,
     PROP_MODE,
+    PROP_ROI_X,
+    PROP_ROI_Y,
+    PROP_ROI_WIDTH,
+    PROP_ROI_HEIGHT,
+    PROP_OUTPUT_BINNING,
+    PROP_HALF_PRECISION,
     N_PROPERTIES
 };
 
@@ -78,6 +110,220 @@ ufo_backproject_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_BACKPROJECT_TASK, NULL));
 }
 
+/*
+ * Copies each projection between zero columns, one in front and two behind.
+ * Clamping a detector position to the padded row then reads zero outside of
+ * the detector without branches, like the sampler with CLK_ADDRESS_CLAMP.
+ */
+static gfloat *
+pad_sinogram (const gfloat *sinogram, gsize width, guint n_projections)
+{
+    gsize padded_width = width + 3;
+    gfloat *padded;
+
+    padded = g_malloc0 (padded_width * n_projections * sizeof (gfloat));
+
+    for (guint proj = 0; proj < n_projections; proj++) {
+        const gfloat *src = sinogram + proj * width;
+        gfloat *dst = padded + proj * padded_width + 1;
+
+        for (gsize x = 0; x < width; x++)
+            dst[x] = isnan (src[x]) ? 0.0f : src[x];
+    }
+
+    return padded;
+}
+
+/*
+ * Adds one projection to a row of a tile. The padded detector position is t
+ * at the first pixel and grows by step per pixel, its sample is interpolated
+ * linearly between the neighbouring detector pixels.
+ */
+static void
+accumulate_row (gfloat *acc,
+                const gfloat *row,
+                gsize n_pixels,
+                gfloat t,
+                gfloat step,
+                gfloat limit)
+{
+    gsize x = 0;
+
+#ifdef __SSE2__
+    __m128 offsets = _mm_mul_ps (_mm_set1_ps (step), _mm_setr_ps (0.0f, 1.0f, 2.0f, 3.0f));
+    __m128 vlow = _mm_setzero_ps ();
+    __m128 vhigh = _mm_set1_ps (limit);
+    gint32 idx[4];
+
+    for (; x + 4 <= n_pixels; x += 4) {
+        __m128 v = _mm_add_ps (_mm_set1_ps (t + x * step), offsets);
+        __m128i i;
+        __m128 frac, a, b;
+
+        v = _mm_min_ps (_mm_max_ps (v, vlow), vhigh);
+        i = _mm_cvttps_epi32 (v);
+        frac = _mm_sub_ps (v, _mm_cvtepi32_ps (i));
+        _mm_storeu_si128 ((__m128i *) idx, i);
+
+        a = _mm_setr_ps (row[idx[0]], row[idx[1]], row[idx[2]], row[idx[3]]);
+        b = _mm_setr_ps (row[idx[0] + 1], row[idx[1] + 1], row[idx[2] + 1], row[idx[3] + 1]);
+        a = _mm_add_ps (a, _mm_mul_ps (frac, _mm_sub_ps (b, a)));
+        _mm_storeu_ps (acc + x, _mm_add_ps (_mm_loadu_ps (acc + x), a));
+    }
+#endif
+
+    for (; x < n_pixels; x++) {
+        gfloat v = CLAMP (t + x * step, 0.0f, limit);
+        gint i = (gint) v;
+
+        acc[x] += row[i] + (v - i) * (row[i + 1] - row[i]);
+    }
+}
+
+/*
+ * Reconstructs the requested region of one slice like the texture kernel.
+ * Each thread accumulates a tile that stays in cache while all projections
+ * are added to it.
+ */
+static void
+backproject_cpu (UfoBackprojectTaskPrivate *priv,
+                 const gfloat *sinogram,
+                 gfloat *slice,
+                 gsize out_width,
+                 gsize out_height,
+                 gfloat axis_pos)
+{
+    const gfloat *sin_lut = priv->host_sin_lut + priv->offset;
+    const gfloat *cos_lut = priv->host_cos_lut + priv->offset;
+    const guint n_projections = priv->burst_projections;
+    const gsize width = priv->sinogram_width;
+    const gsize padded_width = width + 3;
+    const gfloat step = (gfloat) priv->binning;
+    const gsize n_tiles_x = (out_width + TILE_SIZE - 1) / TILE_SIZE;
+    const gsize n_tiles_y = (out_height + TILE_SIZE - 1) / TILE_SIZE;
+    const glong n_tiles = (glong) (n_tiles_x * n_tiles_y);
+    gfloat *padded;
+
+    padded = pad_sinogram (sinogram, width, n_projections);
+
+#pragma omp parallel for schedule(dynamic)
+    for (glong tile = 0; tile < n_tiles; tile++) {
+        gfloat acc[TILE_SIZE * TILE_SIZE];
+        gsize x0 = ((gsize) tile % n_tiles_x) * TILE_SIZE;
+        gsize y0 = ((gsize) tile / n_tiles_x) * TILE_SIZE;
+        gsize tile_width = MIN (TILE_SIZE, out_width - x0);
+        gsize tile_height = MIN (TILE_SIZE, out_height - y0);
+        gfloat bx = priv->x_offset + x0 * step - axis_pos;
+
+        memset (acc, 0, sizeof (acc));
+
+        for (guint proj = 0; proj < n_projections; proj++) {
+            const gfloat *row = padded + proj * padded_width;
+            gfloat c = cos_lut[proj];
+            gfloat s = sin_lut[proj];
+
+            for (gsize y = 0; y < tile_height; y++) {
+                gfloat by = priv->y_offset + (y0 + y) * step - axis_pos;
+
+                /* Detector position of the kernels shifted into the padded row */
+                gfloat t = by * s + bx * c + axis_pos + 0.5f;
+
+                accumulate_row (acc + y * TILE_SIZE, row, tile_width, t, c * step, (gfloat) (width + 1));
+            }
+        }
+
+        for (gsize y = 0; y < tile_height; y++) {
+            for (gsize x = 0; x < tile_width; x++)
+                slice[(y0 + y) * out_width + x0 + x] = acc[y * TILE_SIZE + x] * 4.0f * G_PI;
+        }
+    }
+
+    g_free (padded);
+}
+
+static void
+release_half_mems (UfoBackprojectTaskPrivate *priv)
+{
+    if (priv->half_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->half_mem));
+        priv->half_mem = NULL;
+    }
+
+    if (priv->half_image) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->half_image));
+        priv->half_image = NULL;
+    }
+}
+
+/*
+ * Rounds the sinograms to half precision once per input. The kernels read
+ * each sample many times, which then costs half the memory traffic. Texture
+ * mode copies the result into a CL_HALF_FLOAT image.
+ */
+static cl_mem
+convert_to_half (UfoBackprojectTaskPrivate *priv,
+                 UfoBuffer *input,
+                 cl_command_queue cmd_queue,
+                 UfoProfiler *profiler)
+{
+    UfoRequisition req;
+    cl_mem float_mem;
+    gsize n_elements;
+    gboolean multi;
+
+    ufo_buffer_get_requisition (input, &req);
+    multi = req.n_dims == 3;
+    n_elements = req.dims[0] * req.dims[1] * (multi ? req.dims[2] : 1);
+
+    if (priv->half_mem != NULL && ufo_buffer_cmp_dimensions (input, &priv->half_req) != 0)
+        release_half_mems (priv);
+
+    if (priv->half_mem == NULL) {
+        cl_int err;
+
+        priv->half_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE,
+                                         n_elements * sizeof (cl_half), NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+
+        if (priv->mode == MODE_TEXTURE) {
+            cl_image_format format;
+
+            format.image_channel_order = CL_R;
+            format.image_channel_data_type = CL_HALF_FLOAT;
+
+            if (multi)
+                priv->half_image = clCreateImage3D (priv->context, CL_MEM_READ_ONLY, &format,
+                                                    req.dims[0], req.dims[1], req.dims[2],
+                                                    0, 0, NULL, &err);
+            else
+                priv->half_image = clCreateImage2D (priv->context, CL_MEM_READ_ONLY, &format,
+                                                    req.dims[0], req.dims[1], 0, NULL, &err);
+
+            UFO_RESOURCES_CHECK_CLERR (err);
+        }
+
+        priv->half_req = req;
+    }
+
+    float_mem = ufo_buffer_get_device_array (input, cmd_queue);
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->half_kernel, 0, sizeof (cl_mem), &float_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->half_kernel, 1, sizeof (cl_mem), &priv->half_mem));
+    ufo_profiler_call (profiler, cmd_queue, priv->half_kernel, 1, &n_elements, NULL);
+
+    if (priv->mode == MODE_TEXTURE) {
+        size_t origin[] = { 0, 0, 0 };
+        size_t region[] = { req.dims[0], req.dims[1], multi ? req.dims[2] : 1 };
+
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyBufferToImage (cmd_queue,
+                                                               priv->half_mem, priv->half_image,
+                                                               0, origin, region,
+                                                               0, NULL, NULL));
+        return priv->half_image;
+    }
+
+    return priv->half_mem;
+}
+
 static gboolean
 ufo_backproject_task_process (UfoTask *task,
                               UfoBuffer **inputs,
@@ -92,26 +338,55 @@ ufo_backproject_task_process (UfoTask *task,
     cl_mem out_mem;
     cl_kernel kernel;
     gfloat axis_pos;
+    gfloat step;
+    gboolean multi;
 
     priv = UFO_BACKPROJECT_TASK (task)->priv;
+    multi = requisition->n_dims == 3;
+
+    step = (gfloat) priv->binning;
+
+    /* Guess axis position if they are not provided by the user. */
+    if (priv->axis_pos <= 0.0)
+        axis_pos = (gfloat) ((gfloat) priv->sinogram_width) / 2.0f;
+    else
+        axis_pos = priv->axis_pos;
+
+    if (priv->mode == MODE_CPU) {
+        gfloat *sinograms = ufo_buffer_get_host_array (inputs[0], NULL);
+        gfloat *slices = ufo_buffer_get_host_array (output, NULL);
+        gsize out_width = requisition->dims[0];
+        gsize out_height = requisition->dims[1];
+        guint n_slices = multi ? (guint) requisition->dims[2] : 1;
+
+        for (guint i = 0; i < n_slices; i++)
+            backproject_cpu (priv, sinograms + i * priv->sinogram_width * priv->burst_projections,
+                             slices + i * out_width * out_height, out_width, out_height, axis_pos);
+
+        return TRUE;
+    }
+
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
 
     if (priv->mode == MODE_TEXTURE) {
-        in_mem = ufo_buffer_get_device_image (inputs[0], cmd_queue);
-        kernel = priv->texture_kernel;
+        if (priv->half_precision)
+            in_mem = convert_to_half (priv, inputs[0], cmd_queue, profiler);
+        else
+            in_mem = ufo_buffer_get_device_image (inputs[0], cmd_queue);
+
+        kernel = multi ? priv->texture_multi_kernel : priv->texture_kernel;
     }
     else {
-        in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
-        kernel = priv->nearest_kernel;
-    }
+        if (priv->half_precision)
+            in_mem = convert_to_half (priv, inputs[0], cmd_queue, profiler);
+        else
+            in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
 
-    /* Guess axis position if they are not provided by the user. */
-    if (priv->axis_pos <= 0.0)
-        axis_pos = (gfloat) ((gfloat) requisition->dims[0]) / 2.0f;
-    else
-        axis_pos = priv->axis_pos;
+        kernel = multi ? priv->nearest_multi_kernel : priv->nearest_kernel;
+    }
 
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_mem));
@@ -120,9 +395,25 @@ ufo_backproject_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (guint),  &priv->offset));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (guint),  &priv->burst_projections));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (gfloat), &axis_pos));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 7, sizeof (guint),  &priv->sinogram_width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (gfloat), &priv->x_offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 9, sizeof (gfloat), &priv->y_offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 10, sizeof (gfloat), &step));
 
-    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-    ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, NULL);
+    if (multi) {
+        guint n_slices = (guint) requisition->dims[2];
+        gsize global_size[3];
+
+        global_size[0] = requisition->dims[0];
+        global_size[1] = requisition->dims[1];
+        global_size[2] = (n_slices + SLICES_PER_ITEM - 1) / SLICES_PER_ITEM;
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 11, sizeof (guint), &n_slices));
+        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_size, NULL);
+    }
+    else {
+        ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, NULL);
+    }
 
     return TRUE;
 }
@@ -133,12 +424,22 @@ ufo_backproject_task_setup (UfoTask *task,
                             GError **error)
 {
     UfoBackprojectTaskPrivate *priv;
+    const gchar *opts;
 
     priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
 
+    /* The CPU mode only needs the host tables */
+    if (priv->mode == MODE_CPU)
+        return;
+
     priv->context = ufo_resources_get_context (resources);
-    priv->nearest_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_nearest", error);
+    /* Buffer kernels are built for half sinograms if requested */
+    opts = priv->half_precision ? "-DHALF_SINOGRAM" : "";
+
+    priv->nearest_kernel = ufo_resources_get_kernel_with_opts (resources, "backproject.cl", "backproject_nearest", opts, error);
     priv->texture_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex", error);
+    priv->nearest_multi_kernel = ufo_resources_get_kernel_with_opts (resources, "backproject.cl", "backproject_nearest_multi", opts, error);
+    priv->texture_multi_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex_multi", error);
 
     UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
 
@@ -147,6 +448,31 @@ ufo_backproject_task_setup (UfoTask *task,
 
     if (priv->texture_kernel != NULL)
         UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->texture_kernel));
+
+    if (priv->nearest_multi_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->nearest_multi_kernel));
+
+    if (priv->texture_multi_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->texture_multi_kernel));
+
+    if (priv->half_precision) {
+        priv->half_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "float_to_half", error);
+
+        if (priv->half_kernel != NULL)
+            UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->half_kernel));
+    }
+}
+
+static void
+fill_lut (UfoBackprojectTaskPrivate *priv,
+          gfloat **host_mem,
+          gsize n_entries,
+          double (*func)(double))
+{
+    *host_mem = g_realloc (*host_mem, n_entries * sizeof (gfloat));
+
+    for (guint i = 0; i < n_entries; i++)
+        (*host_mem)[i] = (gfloat) func (priv->angle_offset + i * priv->real_angle_step);
 }
 
 static cl_mem
@@ -159,10 +485,7 @@ create_lut_buffer (UfoBackprojectTaskPrivate *priv,
     gsize size = n_entries * sizeof (gfloat);
     cl_mem mem = NULL;
 
-    *host_mem = g_realloc (*host_mem, size);
-
-    for (guint i = 0; i < n_entries; i++)
-        (*host_mem)[i] = (gfloat) func (priv->angle_offset + i * priv->real_angle_step);
+    fill_lut (priv, host_mem, n_entries, func);
 
     mem = clCreateBuffer (priv->context,
                           CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
@@ -194,6 +517,8 @@ ufo_backproject_task_get_requisition (UfoTask *task,
 {
     UfoBackprojectTaskPrivate *priv;
     UfoRequisition in_req;
+    guint roi_width;
+    guint roi_height;
 
     priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], &in_req);
@@ -210,9 +535,36 @@ ufo_backproject_task_get_requisition (UfoTask *task,
                 "or equal to sinogram height (%u)", priv->n_projections, priv->burst_projections);
     }
 
-    requisition->n_dims = 2;
-    requisition->dims[0] = in_req.dims[0];
-    requisition->dims[1] = in_req.dims[0];
+    priv->sinogram_width = (guint) in_req.dims[0];
+
+    if (priv->roi_x >= priv->sinogram_width || priv->roi_y >= priv->sinogram_width) {
+        g_error ("Region of interest at (%u, %u) lies outside of the %u x %u slice",
+                 priv->roi_x, priv->roi_y, priv->sinogram_width, priv->sinogram_width);
+    }
+
+    /*
+     * Only the region of interest is evaluated, binned output pixels are
+     * sampled at the centre of the pixels they cover.
+     */
+    roi_width = priv->sinogram_width - priv->roi_x;
+    roi_height = priv->sinogram_width - priv->roi_y;
+
+    if (priv->roi_width > 0)
+        roi_width = MIN (roi_width, priv->roi_width);
+
+    if (priv->roi_height > 0)
+        roi_height = MIN (roi_height, priv->roi_height);
+
+    priv->x_offset = priv->roi_x + (priv->binning - 1) / 2.0f;
+    priv->y_offset = priv->roi_y + (priv->binning - 1) / 2.0f;
+
+    /* A stack of sinograms is reconstructed into a stack of slices */
+    requisition->n_dims = in_req.n_dims == 3 ? 3 : 2;
+    requisition->dims[0] = (roi_width + priv->binning - 1) / priv->binning;
+    requisition->dims[1] = (roi_height + priv->binning - 1) / priv->binning;
+
+    if (in_req.n_dims == 3)
+        requisition->dims[2] = in_req.dims[2];
 
     if (priv->real_angle_step < 0.0) {
         if (priv->angle_step <= 0.0)
@@ -223,9 +575,22 @@ ufo_backproject_task_get_requisition (UfoTask *task,
 
     if (priv->luts_changed) {
         release_lut_mems (priv);
+        g_free (priv->host_sin_lut);
+        g_free (priv->host_cos_lut);
+        priv->host_sin_lut = NULL;
+        priv->host_cos_lut = NULL;
         priv->luts_changed = FALSE;
     }
 
+    if (priv->mode == MODE_CPU) {
+        if (priv->host_sin_lut == NULL) {
+            fill_lut (priv, &priv->host_sin_lut, priv->n_projections, sin);
+            fill_lut (priv, &priv->host_cos_lut, priv->n_projections, cos);
+        }
+
+        return;
+    }
+
     if (priv->sin_lut == NULL) {
         priv->sin_lut = create_lut_buffer (priv, &priv->host_sin_lut,
                                            priv->n_projections, sin);
@@ -254,6 +619,11 @@ ufo_filter_task_get_num_dimensions (UfoTask *task,
 static UfoTaskMode
 ufo_filter_task_get_mode (UfoTask *task)
 {
+    UfoBackprojectTaskPrivate *priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
+
+    if (priv->mode == MODE_CPU)
+        return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_CPU;
+
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
 }
 
@@ -273,6 +643,7 @@ ufo_backproject_task_finalize (GObject *object)
     priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (object);
 
     release_lut_mems (priv);
+    release_half_mems (priv);
 
     g_free (priv->host_sin_lut);
     g_free (priv->host_cos_lut);
@@ -287,6 +658,21 @@ ufo_backproject_task_finalize (GObject *object)
         priv->texture_kernel = NULL;
     }
 
+    if (priv->nearest_multi_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->nearest_multi_kernel));
+        priv->nearest_multi_kernel = NULL;
+    }
+
+    if (priv->texture_multi_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->texture_multi_kernel));
+        priv->texture_multi_kernel = NULL;
+    }
+
+    if (priv->half_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->half_kernel));
+        priv->half_kernel = NULL;
+    }
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -336,6 +722,26 @@ ufo_backproject_task_set_property (GObject *object,
                 priv->mode = MODE_NEAREST;
             else if (!g_strcmp0 (g_value_get_string (value), "texture"))
                 priv->mode = MODE_TEXTURE;
+            else if (!g_strcmp0 (g_value_get_string (value), "cpu"))
+                priv->mode = MODE_CPU;
+            break;
+        case PROP_ROI_X:
+            priv->roi_x = g_value_get_uint (value);
+            break;
+        case PROP_ROI_Y:
+            priv->roi_y = g_value_get_uint (value);
+            break;
+        case PROP_ROI_WIDTH:
+            priv->roi_width = g_value_get_uint (value);
+            break;
+        case PROP_ROI_HEIGHT:
+            priv->roi_height = g_value_get_uint (value);
+            break;
+        case PROP_OUTPUT_BINNING:
+            priv->binning = g_value_get_uint (value);
+            break;
+        case PROP_HALF_PRECISION:
+            priv->half_precision = g_value_get_boolean (value);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -375,8 +781,29 @@ ufo_backproject_task_get_property (GObject *object,
                 case MODE_TEXTURE:
                     g_value_set_string (value, "texture");
                     break;
+                case MODE_CPU:
+                    g_value_set_string (value, "cpu");
+                    break;
             }
             break;
+        case PROP_ROI_X:
+            g_value_set_uint (value, priv->roi_x);
+            break;
+        case PROP_ROI_Y:
+            g_value_set_uint (value, priv->roi_y);
+            break;
+        case PROP_ROI_WIDTH:
+            g_value_set_uint (value, priv->roi_width);
+            break;
+        case PROP_ROI_HEIGHT:
+            g_value_set_uint (value, priv->roi_height);
+            break;
+        case PROP_OUTPUT_BINNING:
+            g_value_set_uint (value, priv->binning);
+            break;
+        case PROP_HALF_PRECISION:
+            g_value_set_boolean (value, priv->half_precision);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -435,10 +862,52 @@ ufo_backproject_task_class_init (UfoBackprojectTaskClass *klass)
     properties[PROP_MODE] =
         g_param_spec_string ("mode",
                              "Backprojection mode",
-                             "Backprojection mode from: \"nearest\", \"texture\"",
+                             "Backprojection mode from: \"nearest\", \"texture\", \"cpu\"",
                              "texture",
                              G_PARAM_READWRITE);
 
+    properties[PROP_ROI_X] =
+        g_param_spec_uint ("roi-x",
+                           "Horizontal coordinate of the region of interest",
+                           "Horizontal coordinate of the first reconstructed pixel",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_ROI_Y] =
+        g_param_spec_uint ("roi-y",
+                           "Vertical coordinate of the region of interest",
+                           "Vertical coordinate of the first reconstructed pixel",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_ROI_WIDTH] =
+        g_param_spec_uint ("roi-width",
+                           "Width of the region of interest",
+                           "Width of the region of interest, 0 reconstructs up to the right edge",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_ROI_HEIGHT] =
+        g_param_spec_uint ("roi-height",
+                           "Height of the region of interest",
+                           "Height of the region of interest, 0 reconstructs up to the bottom edge",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_OUTPUT_BINNING] =
+        g_param_spec_uint ("output-binning",
+                           "Binning of the reconstructed slice",
+                           "Each output pixel covers binning x binning pixels of the region of interest",
+                           1, 64, 1,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_HALF_PRECISION] =
+        g_param_spec_boolean ("half-precision",
+                              "Store sinograms in half precision",
+                              "Round sinograms to half floats on the device before backprojecting them, sums stay in single precision",
+                              FALSE,
+                              G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -454,6 +923,12 @@ ufo_backproject_task_init (UfoBackprojectTask *self)
     self->priv = priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (self);
     priv->nearest_kernel = NULL;
     priv->texture_kernel = NULL;
+    priv->nearest_multi_kernel = NULL;
+    priv->texture_multi_kernel = NULL;
+    priv->half_kernel = NULL;
+    priv->half_mem = NULL;
+    priv->half_image = NULL;
+    priv->half_precision = FALSE;
     priv->n_projections = 0;
     priv->offset = 0;
     priv->axis_pos = -1.0;
@@ -466,4 +941,9 @@ ufo_backproject_task_init (UfoBackprojectTask *self)
     priv->host_cos_lut = NULL;
     priv->mode = MODE_TEXTURE;
     priv->luts_changed = TRUE;
+    priv->roi_x = 0;
+    priv->roi_y = 0;
+    priv->roi_width = 0;
+    priv->roi_height = 0;
+    priv->binning = 1;
 }
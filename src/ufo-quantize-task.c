@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "ufo-quantize-task.h"
+#include "ufo-priv.h"
+
+/* Number of work groups computing partial extrema */
+#define N_GROUPS 64
+
+/* Upper bound for the reduction work group size */
+#define MAX_LOCAL_SIZE 256
+
+struct _UfoQuantizeTaskPrivate {
+    cl_context context;
+    cl_kernel minmax_kernel;
+    cl_kernel minmax_final_kernel;
+    cl_kernel quantize_kernel;
+    cl_mem partial_mem;
+    cl_mem range_mem;
+    gsize local_size;
+    guint bits;
+    gfloat minimum;
+    gfloat maximum;
+};
+
+static void ufo_task_interface_init (UfoTaskIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UfoQuantizeTask, ufo_quantize_task, UFO_TYPE_TASK_NODE,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
+                                                ufo_task_interface_init))
+
+#define UFO_QUANTIZE_TASK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_QUANTIZE_TASK, UfoQuantizeTaskPrivate))
+
+enum {
+    PROP_0,
+    PROP_BITS,
+    PROP_MINIMUM,
+    PROP_MAXIMUM,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+UfoNode *
+ufo_quantize_task_new (void)
+{
+    return UFO_NODE (g_object_new (UFO_TYPE_QUANTIZE_TASK, NULL));
+}
+
+static gboolean
+has_fixed_range (UfoQuantizeTaskPrivate *priv)
+{
+    return priv->minimum < priv->maximum;
+}
+
+/* Largest power of two that every device can run the reduction with */
+static gsize
+get_local_size (UfoResources *resources, cl_kernel kernel)
+{
+    GList *devices;
+    GList *it;
+    gsize max_size = MAX_LOCAL_SIZE;
+    gsize local_size = 1;
+
+    devices = ufo_resources_get_devices (resources);
+
+    g_list_for (devices, it) {
+        size_t size = 0;
+
+        UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, (cl_device_id) it->data,
+                                                             CL_KERNEL_WORK_GROUP_SIZE,
+                                                             sizeof (size_t), &size, NULL));
+        max_size = MIN (max_size, size);
+    }
+
+    while (local_size * 2 <= max_size)
+        local_size *= 2;
+
+    return local_size;
+}
+
+static void
+ufo_quantize_task_setup (UfoTask *task,
+                         UfoResources *resources,
+                         GError **error)
+{
+    UfoQuantizeTaskPrivate *priv;
+    cl_int err;
+
+    priv = UFO_QUANTIZE_TASK_GET_PRIVATE (task);
+
+    if (priv->bits != 8 && priv->bits != 16) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "::bits must be 8 or 16");
+        return;
+    }
+
+    priv->context = ufo_resources_get_context (resources);
+    priv->minmax_kernel = ufo_resources_get_kernel (resources, "quantize.cl", "minmax", error);
+    priv->minmax_final_kernel = ufo_resources_get_kernel (resources, "quantize.cl", "minmax_final", error);
+    priv->quantize_kernel = ufo_resources_get_kernel (resources, "quantize.cl",
+                                                      priv->bits == 8 ? "quantize_8" : "quantize_16", error);
+
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
+
+    if (priv->minmax_kernel == NULL || priv->minmax_final_kernel == NULL || priv->quantize_kernel == NULL)
+        return;
+
+    UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->minmax_kernel));
+    UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->minmax_final_kernel));
+    UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->quantize_kernel));
+
+    priv->local_size = MIN (get_local_size (resources, priv->minmax_kernel),
+                            get_local_size (resources, priv->minmax_final_kernel));
+
+    priv->partial_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE,
+                                        2 * N_GROUPS * sizeof (gfloat), NULL, &err);
+    UFO_RESOURCES_CHECK_CLERR (err);
+
+    /* A fixed range is uploaded once, otherwise the reduction fills it */
+    if (has_fixed_range (priv)) {
+        gfloat range[2] = { priv->minimum, priv->maximum };
+
+        priv->range_mem = clCreateBuffer (priv->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                          sizeof (range), range, &err);
+    }
+    else {
+        priv->range_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE,
+                                          2 * sizeof (gfloat), NULL, &err);
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (err);
+}
+
+static void
+ufo_quantize_task_get_requisition (UfoTask *task,
+                                   UfoBuffer **inputs,
+                                   UfoRequisition *requisition)
+{
+    UfoQuantizeTaskPrivate *priv;
+    UfoRequisition in_req;
+    gsize n_bytes;
+
+    priv = UFO_QUANTIZE_TASK_GET_PRIVATE (task);
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+
+    /*
+     * Samples are packed into as many float-sized words as needed, so only
+     * the quantized bytes are transferred to the host.
+     */
+    n_bytes = in_req.dims[0] * in_req.dims[1] * priv->bits / 8;
+    requisition->n_dims = 2;
+    requisition->dims[0] = (n_bytes + sizeof (gfloat) - 1) / sizeof (gfloat);
+    requisition->dims[1] = 1;
+}
+
+static guint
+ufo_quantize_task_get_num_inputs (UfoTask *task)
+{
+    return 1;
+}
+
+static guint
+ufo_quantize_task_get_num_dimensions (UfoTask *task,
+                                      guint input)
+{
+    g_return_val_if_fail (input == 0, 0);
+    return 2;
+}
+
+static UfoTaskMode
+ufo_quantize_task_get_mode (UfoTask *task)
+{
+    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
+}
+
+static void
+set_quantize_metadata (UfoBuffer *output, guint bits, UfoRequisition *requisition)
+{
+    GValue value = G_VALUE_INIT;
+    g_value_init (&value, G_TYPE_UINT);
+
+    g_value_set_uint (&value, bits);
+    ufo_buffer_set_metadata (output, "quantize-bits", &value);
+
+    g_value_set_uint (&value, (guint) requisition->dims[0]);
+    ufo_buffer_set_metadata (output, "quantize-width", &value);
+
+    g_value_set_uint (&value, (guint) requisition->dims[1]);
+    ufo_buffer_set_metadata (output, "quantize-height", &value);
+}
+
+static gboolean
+ufo_quantize_task_process (UfoTask *task,
+                           UfoBuffer **inputs,
+                           UfoBuffer *output,
+                           UfoRequisition *requisition)
+{
+    UfoQuantizeTaskPrivate *priv;
+    UfoGpuNode *node;
+    UfoProfiler *profiler;
+    UfoRequisition in_req;
+    cl_command_queue cmd_queue;
+    cl_mem in_mem;
+    cl_mem out_mem;
+    cl_uint n_pixels;
+    gsize n_words;
+
+    priv = UFO_QUANTIZE_TASK_GET_PRIVATE (task);
+    node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+    cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+    in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
+    out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+    n_pixels = (cl_uint) (in_req.dims[0] * in_req.dims[1]);
+
+    /* Partial extrema per work group, then a single group combines them */
+    if (!has_fixed_range (priv)) {
+        gsize global_size = N_GROUPS * priv->local_size;
+        gsize local_size = priv->local_size;
+        cl_uint n_groups = N_GROUPS;
+        gfloat limit = priv->bits == 8 ? 255.0f : 65535.0f;
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_kernel, 0, sizeof (cl_mem), &in_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_kernel, 1, sizeof (cl_mem), &priv->partial_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_kernel, 2, local_size * sizeof (gfloat), NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_kernel, 3, local_size * sizeof (gfloat), NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_kernel, 4, sizeof (cl_uint), &n_pixels));
+        ufo_profiler_call (profiler, cmd_queue, priv->minmax_kernel, 1, &global_size, &local_size);
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_final_kernel, 0, sizeof (cl_mem), &priv->partial_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_final_kernel, 1, sizeof (cl_mem), &priv->range_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_final_kernel, 2, local_size * sizeof (gfloat), NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_final_kernel, 3, local_size * sizeof (gfloat), NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_final_kernel, 4, sizeof (cl_uint), &n_groups));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->minmax_final_kernel, 5, sizeof (gfloat), &limit));
+        ufo_profiler_call (profiler, cmd_queue, priv->minmax_final_kernel, 1, &local_size, &local_size);
+    }
+
+    /* One work item per packed word */
+    n_words = requisition->dims[0];
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 1, sizeof (cl_mem), &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 2, sizeof (cl_mem), &priv->range_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 3, sizeof (cl_uint), &n_pixels));
+    ufo_profiler_call (profiler, cmd_queue, priv->quantize_kernel, 1, &n_words, NULL);
+
+    set_quantize_metadata (output, priv->bits, &in_req);
+
+    return TRUE;
+}
+
+static void
+ufo_quantize_task_set_property (GObject *object,
+                                guint property_id,
+                                const GValue *value,
+                                GParamSpec *pspec)
+{
+    UfoQuantizeTaskPrivate *priv = UFO_QUANTIZE_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BITS:
+            priv->bits = g_value_get_uint (value);
+            break;
+        case PROP_MINIMUM:
+            priv->minimum = g_value_get_float (value);
+            break;
+        case PROP_MAXIMUM:
+            priv->maximum = g_value_get_float (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_quantize_task_get_property (GObject *object,
+                                guint property_id,
+                                GValue *value,
+                                GParamSpec *pspec)
+{
+    UfoQuantizeTaskPrivate *priv = UFO_QUANTIZE_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BITS:
+            g_value_set_uint (value, priv->bits);
+            break;
+        case PROP_MINIMUM:
+            g_value_set_float (value, priv->minimum);
+            break;
+        case PROP_MAXIMUM:
+            g_value_set_float (value, priv->maximum);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_quantize_task_finalize (GObject *object)
+{
+    UfoQuantizeTaskPrivate *priv;
+
+    priv = UFO_QUANTIZE_TASK_GET_PRIVATE (object);
+
+    if (priv->minmax_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->minmax_kernel));
+        priv->minmax_kernel = NULL;
+    }
+    if (priv->minmax_final_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->minmax_final_kernel));
+        priv->minmax_final_kernel = NULL;
+    }
+    if (priv->quantize_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->quantize_kernel));
+        priv->quantize_kernel = NULL;
+    }
+    if (priv->partial_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->partial_mem));
+        priv->partial_mem = NULL;
+    }
+    if (priv->range_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->range_mem));
+        priv->range_mem = NULL;
+    }
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
+    G_OBJECT_CLASS (ufo_quantize_task_parent_class)->finalize (object);
+}
+
+static void
+ufo_task_interface_init (UfoTaskIface *iface)
+{
+    iface->setup = ufo_quantize_task_setup;
+    iface->get_requisition = ufo_quantize_task_get_requisition;
+    iface->get_num_inputs = ufo_quantize_task_get_num_inputs;
+    iface->get_num_dimensions = ufo_quantize_task_get_num_dimensions;
+    iface->get_mode = ufo_quantize_task_get_mode;
+    iface->process = ufo_quantize_task_process;
+}
+
+static void
+ufo_quantize_task_class_init (UfoQuantizeTaskClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->set_property = ufo_quantize_task_set_property;
+    gobject_class->get_property = ufo_quantize_task_get_property;
+    gobject_class->finalize = ufo_quantize_task_finalize;
+
+    properties[PROP_BITS] =
+        g_param_spec_uint ("bits",
+                           "Number of bits per sample",
+                           "Number of bits per sample. Possible values in [8, 16].",
+                           8, 16, 8, G_PARAM_READWRITE);
+
+    properties[PROP_MINIMUM] =
+        g_param_spec_float ("minimum",
+                            "Value mapped to zero",
+                            "Value mapped to zero, used if smaller than maximum, otherwise the range of each frame is computed on the device",
+                            -G_MAXFLOAT, G_MAXFLOAT, 0.0f, G_PARAM_READWRITE);
+
+    properties[PROP_MAXIMUM] =
+        g_param_spec_float ("maximum",
+                            "Value mapped to the largest integer",
+                            "Value mapped to the largest integer, used if larger than minimum",
+                            -G_MAXFLOAT, G_MAXFLOAT, 0.0f, G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (gobject_class, i, properties[i]);
+
+    g_type_class_add_private (gobject_class, sizeof(UfoQuantizeTaskPrivate));
+}
+
+static void
+ufo_quantize_task_init(UfoQuantizeTask *self)
+{
+    self->priv = UFO_QUANTIZE_TASK_GET_PRIVATE(self);
+    self->priv->bits = 8;
+    self->priv->minimum = 0.0f;
+    self->priv->maximum = 0.0f;
+    self->priv->local_size = 1;
+}
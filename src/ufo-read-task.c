@@ -21,12 +21,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <glob.h>
+#include <sys/stat.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
 
 #include "config.h"
 #include "ufo-read-task.h"
 
 #include "readers/ufo-reader.h"
 #include "readers/ufo-edf-reader.h"
+#include "readers/ufo-raw-reader.h"
 
 #ifdef HAVE_TIFF
 #include "readers/ufo-tiff-reader.h"
@@ -37,25 +45,70 @@
 #endif
 
 
+/* Decoded frames a read job may hold before it waits for them to be taken */
+#define FRAMES_PER_JOB 2
+
+typedef struct {
+    const gchar *filename;
+    GList       *frames;
+    guint        n_frames;
+    guint        max_frames;
+    UfoBufferDepth depth;
+    gboolean     finished;
+} ReadJob;
+
 struct _UfoReadTaskPrivate {
     gchar   *path;
-    GList   *filenames;
-    GList   *current_element;
+    gchar   *index_path;
+    GPtrArray *filenames;
+    guint    current_index;
     guint    current;
     guint    step;
     guint    start;
     guint    number;
+    gboolean single_file;
     gboolean done;
 
     UfoBufferDepth  depth;
     gboolean convert;
+    gboolean convert_on_device;
+
+    cl_context  context;
+    cl_kernel   convert_u8_kernel;
+    cl_kernel   convert_u16_kernel;
+    UfoBuffer  *native;
+    cl_mem      native_mem;
+    gsize       native_mem_size;
 
     guint    roi_y;
     guint    roi_height;
     guint    roi_step;
+    guint    roi_x;
+    guint    roi_width;
+    guint    roi_x_step;
+    gboolean sinograms;
+
+    guint        read_ahead;
+    GThreadPool *pool;
+    GList       *jobs;
+    guint        next_index;
+    ReadJob     *job;
+    UfoBuffer   *frame;
+
+    guint        batch;
+    UfoBuffer   *batch_buffer;
+    GMutex       lock;
+    GCond        frame_ready;
+    GCond        frame_taken;
+    gboolean     cancelled;
 
     UfoReader       *reader;
     UfoEdfReader    *edf_reader;
+    UfoRawReader    *raw_reader;
+    guint            raw_width;
+    guint            raw_height;
+    guint            raw_bitdepth;
+    guint            raw_offset;
 
 #ifdef HAVE_TIFF
     UfoTiffReader   *tiff_reader;
@@ -63,6 +116,8 @@ struct _UfoReadTaskPrivate {
 
 #ifdef WITH_HDF5
     UfoHdf5Reader   *hdf5_reader;
+    guint            hdf5_batch_size;
+    guint            hdf5_chunk_cache_size;
 #endif
 };
 
@@ -77,13 +132,29 @@ G_DEFINE_TYPE_WITH_CODE (UfoReadTask, ufo_read_task, UFO_TYPE_TASK_NODE,
 enum {
     PROP_0,
     PROP_PATH,
+    PROP_INDEX,
     PROP_START,
     PROP_NUMBER,
     PROP_STEP,
     PROP_ROI_Y,
     PROP_ROI_HEIGHT,
     PROP_ROI_STEP,
+    PROP_ROI_X,
+    PROP_ROI_WIDTH,
+    PROP_ROI_X_STEP,
     PROP_CONVERT,
+    PROP_CONVERT_ON_DEVICE,
+    PROP_SINOGRAMS,
+    PROP_READ_AHEAD,
+    PROP_BATCH,
+    PROP_RAW_WIDTH,
+    PROP_RAW_HEIGHT,
+    PROP_RAW_BITDEPTH,
+    PROP_RAW_OFFSET,
+#ifdef WITH_HDF5
+    PROP_HDF5_BATCH_SIZE,
+    PROP_HDF5_CHUNK_CACHE_SIZE,
+#endif
     N_PROPERTIES
 };
 
@@ -95,48 +166,413 @@ ufo_read_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_READ_TASK, NULL));
 }
 
-static GList *
+static UfoReader *
+get_reader (UfoReadTaskPrivate *priv, const gchar *filename)
+{
+#ifdef HAVE_TIFF
+    if (ufo_reader_can_open (UFO_READER (priv->tiff_reader), filename))
+        return UFO_READER (priv->tiff_reader);
+#endif
+
+#ifdef WITH_HDF5
+    if (ufo_reader_can_open (UFO_READER (priv->hdf5_reader), filename))
+        return UFO_READER (priv->hdf5_reader);
+#endif
+
+    if (ufo_reader_can_open (UFO_READER (priv->edf_reader), filename))
+        return UFO_READER (priv->edf_reader);
+
+    if (ufo_reader_can_open (UFO_READER (priv->raw_reader), filename))
+        return UFO_READER (priv->raw_reader);
+
+    return NULL;
+}
+
+/* Applies the reader properties to @reader, shared or owned by a read job */
+static void
+configure_reader (UfoReadTaskPrivate *priv, UfoReader *reader)
+{
+    if (UFO_IS_RAW_READER (reader))
+        ufo_raw_reader_set_geometry (UFO_RAW_READER (reader), priv->raw_width, priv->raw_height, priv->raw_bitdepth, priv->raw_offset);
+
+#ifdef WITH_HDF5
+    if (UFO_IS_HDF5_READER (reader)) {
+        /* Fill each batch from a single hyperslab read */
+        ufo_hdf5_reader_set_batch_size (UFO_HDF5_READER (reader), MAX (priv->hdf5_batch_size, priv->batch));
+        ufo_hdf5_reader_set_chunk_cache_size (UFO_HDF5_READER (reader), ((gsize) priv->hdf5_chunk_cache_size) << 20);
+    }
+#endif
+}
+
+static gint
+compare_natural (const gchar *a, const gchar *b)
+{
+    while (*a != '\0' && *b != '\0') {
+        if (g_ascii_isdigit (*a) && g_ascii_isdigit (*b)) {
+            const gchar *a_end;
+            const gchar *b_end;
+            gsize a_len;
+            gsize b_len;
+            gint cmp;
+
+            /* Compare runs of digits by value, i.e. by length without leading zeros */
+            while (*a == '0' && g_ascii_isdigit (a[1]))
+                a++;
+
+            while (*b == '0' && g_ascii_isdigit (b[1]))
+                b++;
+
+            for (a_end = a; g_ascii_isdigit (*a_end); a_end++);
+            for (b_end = b; g_ascii_isdigit (*b_end); b_end++);
+
+            a_len = a_end - a;
+            b_len = b_end - b;
+
+            if (a_len != b_len)
+                return a_len < b_len ? -1 : 1;
+
+            cmp = strncmp (a, b, a_len);
+
+            if (cmp != 0)
+                return cmp;
+
+            a = a_end;
+            b = b_end;
+        }
+        else {
+            if (*a != *b)
+                return (guchar) *a < (guchar) *b ? -1 : 1;
+
+            a++;
+            b++;
+        }
+    }
+
+    return (guchar) *a - (guchar) *b;
+}
+
+static gint
+compare_filenames (gconstpointer a, gconstpointer b)
+{
+    return compare_natural (*((const gchar * const *) a), *((const gchar * const *) b));
+}
+
+static gchar *
+get_index_key (const gchar *pattern)
+{
+    struct stat info;
+    gchar *directory;
+    gchar *key = NULL;
+
+    /* Adding or removing files updates the modification time of the directory */
+    directory = g_path_get_dirname (pattern);
+
+    if (stat (directory, &info) == 0)
+        key = g_strdup_printf ("# ufo-read-index %li %li %s", (long) info.st_mtime, (long) info.st_size, pattern);
+
+    g_free (directory);
+    return key;
+}
+
+static GPtrArray *
+load_index (const gchar *index_path, const gchar *key)
+{
+    GPtrArray *result;
+    gchar *contents;
+    gchar **lines;
+
+    if (!g_file_get_contents (index_path, &contents, NULL, NULL))
+        return NULL;
+
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    if (lines[0] == NULL || g_strcmp0 (lines[0], key)) {
+        g_strfreev (lines);
+        return NULL;
+    }
+
+    result = g_ptr_array_new_with_free_func (g_free);
+
+    for (guint i = 1; lines[i] != NULL; i++) {
+        if (lines[i][0] != '\0')
+            g_ptr_array_add (result, g_strdup (lines[i]));
+    }
+
+    g_strfreev (lines);
+    return result;
+}
+
+static void
+save_index (const gchar *index_path, const gchar *key, GPtrArray *filenames)
+{
+    GString *contents;
+    GError *error = NULL;
+
+    contents = g_string_new (key);
+
+    for (guint i = 0; i < filenames->len; i++) {
+        g_string_append_c (contents, '\n');
+        g_string_append (contents, (const gchar *) g_ptr_array_index (filenames, i));
+    }
+
+    g_string_append_c (contents, '\n');
+
+    if (!g_file_set_contents (index_path, contents->str, contents->len, &error)) {
+        g_warning ("read: could not write index `%s': %s", index_path, error->message);
+        g_error_free (error);
+    }
+
+    g_string_free (contents, TRUE);
+}
+
+static GPtrArray *
 read_filenames (UfoReadTaskPrivate *priv)
 {
-    GList *result;
+    GPtrArray *result;
     gchar *pattern;
+    gchar *key = NULL;
     glob_t filenames;
 
-    result = NULL;
+    result = g_ptr_array_new_with_free_func (g_free);
 
 #ifdef WITH_HDF5
-    if (ufo_reader_can_open (UFO_READER (priv->hdf5_reader), priv->path))
-        return g_list_append (NULL, g_strdup (priv->path));
+    if (ufo_reader_can_open (UFO_READER (priv->hdf5_reader), priv->path)) {
+        g_ptr_array_add (result, g_strdup (priv->path));
+        return result;
+    }
 #endif
 
     if (g_file_test (priv->path, G_FILE_TEST_IS_REGULAR)) {
         /* This is a single file without any asterisks */
-        pattern = g_strdup (priv->path);
+        if (get_reader (priv, priv->path) != NULL)
+            g_ptr_array_add (result, g_strdup (priv->path));
+
+        return result;
     }
-    else {
-        /* This is a directory which we may have to glob */
-        pattern = strstr (priv->path, "*") != NULL ? g_strdup (priv->path) : g_build_filename (priv->path, "*", NULL);
+
+    /* This is a directory which we may have to glob */
+    pattern = strstr (priv->path, "*") != NULL ? g_strdup (priv->path) : g_build_filename (priv->path, "*", NULL);
+
+    if (priv->index_path != NULL) {
+        key = get_index_key (pattern);
+
+        if (key != NULL) {
+            GPtrArray *cached;
+
+            cached = load_index (priv->index_path, key);
+
+            if (cached != NULL) {
+                g_ptr_array_unref (result);
+                g_free (key);
+                g_free (pattern);
+                return cached;
+            }
+        }
     }
 
-    glob (pattern, GLOB_MARK | GLOB_TILDE, NULL, &filenames);
+    /* Sorting is done below, there is no need for glob to do it as well */
+    glob (pattern, GLOB_MARK | GLOB_TILDE | GLOB_NOSORT, NULL, &filenames);
 
-    for (guint i = 0; i < filenames.gl_pathc; i++) {
+    for (gsize i = 0; i < filenames.gl_pathc; i++) {
         const gchar *filename = filenames.gl_pathv[i];
 
-#ifdef HAVE_TIFF
-        if (ufo_reader_can_open (UFO_READER (priv->tiff_reader), filename))
-            result = g_list_append (result, g_strdup (filename));
-#endif
-
-        if (ufo_reader_can_open (UFO_READER (priv->edf_reader), filename))
-            result = g_list_append (result, g_strdup (filename));
+        if (get_reader (priv, filename) != NULL)
+            g_ptr_array_add (result, g_strdup (filename));
     }
 
     globfree (&filenames);
+    g_ptr_array_sort (result, compare_filenames);
+
+    if (key != NULL && result->len > 0)
+        save_index (priv->index_path, key, result);
+
+    g_free (key);
     g_free (pattern);
     return result;
 }
 
+static void
+clamp_roi (guint start, guint extent, gsize size, guint *roi_start, guint *roi_extent)
+{
+    *roi_start = start < size ? start : 0;
+
+    if (!extent || *roi_start + extent > size)
+        *roi_extent = size - *roi_start;
+    else
+        *roi_extent = extent;
+}
+
+static guint
+get_num_samples (guint extent, guint step)
+{
+    /* Every step-th row or column starting with the first one */
+    return (extent + step - 1) / step;
+}
+
+/*
+ * The buffer does not own its samples, so that they can be handed over to an
+ * output with hand_over_frame instead of being copied.
+ */
+static UfoBuffer *
+new_frame_buffer (UfoRequisition *requisition)
+{
+    UfoBuffer *buffer;
+    gpointer data;
+
+    buffer = ufo_buffer_new (requisition, NULL);
+    data = g_malloc (ufo_buffer_get_size (buffer));
+    ufo_buffer_set_host_array (buffer, data, FALSE);
+    g_object_set_data_full (G_OBJECT (buffer), "frame-data", data, g_free);
+    return buffer;
+}
+
+static void
+read_job_run (ReadJob *job, UfoReadTaskPrivate *priv)
+{
+    UfoReader *reader;
+
+    /*
+     * Each job uses a reader instance of its own, so that several files can be
+     * opened and decoded at the same time.
+     */
+    reader = UFO_READER (g_object_new (G_OBJECT_TYPE (get_reader (priv, job->filename)), NULL));
+
+    configure_reader (priv, reader);
+    ufo_reader_open (reader, job->filename);
+
+    for (guint i = 0; i < job->max_frames && ufo_reader_data_available (reader); i++) {
+        UfoRequisition requisition;
+        UfoBufferDepth depth;
+        UfoBuffer *frame;
+        gsize width;
+        gsize height;
+        guint roi_y;
+        guint roi_height;
+        guint roi_x;
+        guint roi_width;
+        gboolean cancelled;
+
+        /* Only decode ahead of the consumer by a few frames */
+        g_mutex_lock (&priv->lock);
+
+        while (job->n_frames >= FRAMES_PER_JOB && !priv->cancelled)
+            g_cond_wait (&priv->frame_taken, &priv->lock);
+
+        cancelled = priv->cancelled;
+        g_mutex_unlock (&priv->lock);
+
+        if (cancelled)
+            break;
+
+        ufo_reader_get_meta (reader, &width, &height, &depth);
+        clamp_roi (priv->roi_y, priv->roi_height, height, &roi_y, &roi_height);
+        clamp_roi (priv->roi_x, priv->roi_width, width, &roi_x, &roi_width);
+
+        requisition.n_dims = 2;
+        requisition.dims[0] = get_num_samples (roi_width, priv->roi_x_step);
+        requisition.dims[1] = get_num_samples (roi_height, priv->roi_step);
+
+        frame = new_frame_buffer (&requisition);
+        ufo_reader_read (reader, frame, &requisition,
+                         roi_y, roi_height, priv->roi_step,
+                         roi_x, roi_width, priv->roi_x_step);
+
+        if ((depth != UFO_BUFFER_DEPTH_32F) && priv->convert && !priv->convert_on_device)
+            ufo_buffer_convert (frame, depth);
+
+        g_mutex_lock (&priv->lock);
+        job->depth = depth;
+        job->frames = g_list_append (job->frames, frame);
+        job->n_frames++;
+        g_cond_broadcast (&priv->frame_ready);
+        g_mutex_unlock (&priv->lock);
+    }
+
+    ufo_reader_close (reader);
+    g_object_unref (reader);
+
+    g_mutex_lock (&priv->lock);
+    job->finished = TRUE;
+    g_cond_broadcast (&priv->frame_ready);
+    g_mutex_unlock (&priv->lock);
+}
+
+static void
+push_read_job (UfoReadTaskPrivate *priv)
+{
+    ReadJob *job;
+
+    if (priv->next_index >= priv->filenames->len || priv->current >= priv->number)
+        return;
+
+    job = g_new0 (ReadJob, 1);
+    job->filename = (const gchar *) g_ptr_array_index (priv->filenames, priv->next_index);
+    /* No file has to provide more frames than are still missing */
+    job->max_frames = priv->number - priv->current;
+    priv->jobs = g_list_append (priv->jobs, job);
+    priv->next_index += priv->step;
+    g_thread_pool_push (priv->pool, job, NULL);
+}
+
+static void
+free_read_job (ReadJob *job)
+{
+    g_list_free_full (job->frames, (GDestroyNotify) g_object_unref);
+    g_free (job);
+}
+
+/*
+ * Frames are handed out in file order as soon as they are decoded, regardless
+ * of which worker is ahead. A new file is queued once one is exhausted.
+ */
+static UfoBuffer *
+pop_prefetched_frame (UfoReadTaskPrivate *priv)
+{
+    UfoBuffer *frame = NULL;
+
+    g_mutex_lock (&priv->lock);
+
+    while (frame == NULL) {
+        if (priv->job == NULL) {
+            if (priv->jobs == NULL)
+                break;
+
+            priv->job = (ReadJob *) priv->jobs->data;
+            priv->jobs = g_list_delete_link (priv->jobs, priv->jobs);
+        }
+
+        if (priv->job->frames != NULL) {
+            frame = UFO_BUFFER (priv->job->frames->data);
+            priv->job->frames = g_list_delete_link (priv->job->frames, priv->job->frames);
+            priv->job->n_frames--;
+            priv->depth = priv->job->depth;
+            g_cond_broadcast (&priv->frame_taken);
+        }
+        else if (priv->job->finished) {
+            free_read_job (priv->job);
+            priv->job = NULL;
+            push_read_job (priv);
+        }
+        else {
+            g_cond_wait (&priv->frame_ready, &priv->lock);
+        }
+    }
+
+    g_mutex_unlock (&priv->lock);
+    return frame;
+}
+
+/* Passes the samples of a frame buffer to @output without copying them */
+static void
+hand_over_frame (UfoBuffer *frame, UfoBuffer *output)
+{
+    gpointer data;
+
+    data = g_object_steal_data (G_OBJECT (frame), "frame-data");
+    ufo_buffer_set_host_array (output, data, TRUE);
+}
+
 static void
 ufo_read_task_setup (UfoTask *task,
                      UfoResources *resources,
@@ -146,74 +582,144 @@ ufo_read_task_setup (UfoTask *task,
 
     priv = UFO_READ_TASK_GET_PRIVATE (task);
 
+    configure_reader (priv, UFO_READER (priv->raw_reader));
+#ifdef WITH_HDF5
+    configure_reader (priv, UFO_READER (priv->hdf5_reader));
+#endif
     priv->filenames = read_filenames (priv);
 
-    if (priv->filenames == NULL) {
+    if (priv->filenames->len == 0) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
                      "`%s' does not match any files", priv->path);
         return;
     }
 
-    priv->filenames = g_list_sort (priv->filenames, (GCompareFunc) g_strcmp0);
-    priv->current_element = g_list_nth (priv->filenames, priv->start);
+    /*
+     * For a single multi-frame file (multi EDF, multi-page TIFF or HDF5), start
+     * and step refer to frames within that file rather than to files.
+     */
+    priv->single_file = priv->filenames->len == 1;
+    priv->current_index = priv->single_file ? 0 : priv->start;
     priv->current = 0;
-}
 
-static UfoReader *
-get_reader (UfoReadTaskPrivate *priv, const gchar *filename)
-{
-#ifdef HAVE_TIFF
-    if (ufo_reader_can_open (UFO_READER (priv->tiff_reader), filename))
-        return UFO_READER (priv->tiff_reader);
-#endif
+    if (priv->sinograms) {
+        gboolean supported = FALSE;
 
 #ifdef WITH_HDF5
-    if (ufo_reader_can_open (UFO_READER (priv->hdf5_reader), filename))
-        return UFO_READER (priv->hdf5_reader);
+        if (priv->single_file && ufo_reader_can_open (UFO_READER (priv->hdf5_reader), priv->path)) {
+            /* The vertical ROI selects the detector rows of the sinograms */
+            ufo_hdf5_reader_set_sinograms (priv->hdf5_reader, TRUE, priv->roi_y, priv->roi_height, priv->roi_step);
+            supported = TRUE;
+        }
 #endif
 
-    if (ufo_reader_can_open (UFO_READER (priv->edf_reader), filename))
-        return UFO_READER (priv->edf_reader);
+        if (priv->single_file && ufo_reader_can_open (UFO_READER (priv->raw_reader), priv->path)) {
+            ufo_raw_reader_set_sinograms (priv->raw_reader, TRUE, priv->roi_y, priv->roi_height, priv->roi_step);
+            supported = TRUE;
+        }
 
-    return NULL;
+        if (!supported) {
+            g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                         "`%s' cannot be read as sinograms", priv->path);
+            return;
+        }
+    }
+
+    if (priv->convert_on_device) {
+        priv->context = ufo_resources_get_context (resources);
+        priv->convert_u8_kernel = ufo_resources_get_kernel (resources, "default.cl", "convert_u8_1d", error);
+
+        if (priv->convert_u8_kernel == NULL)
+            return;
+
+        priv->convert_u16_kernel = ufo_resources_get_kernel (resources, "default.cl", "convert_u16_1d", error);
+
+        if (priv->convert_u16_kernel == NULL)
+            return;
+
+        UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->convert_u8_kernel));
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->convert_u16_kernel));
+    }
+
+    if (priv->read_ahead > 0 && !priv->single_file) {
+        priv->pool = g_thread_pool_new ((GFunc) read_job_run, priv, priv->read_ahead, FALSE, error);
+
+        if (priv->pool == NULL)
+            return;
+
+        priv->next_index = priv->current_index;
+
+        for (guint i = 0; i < priv->read_ahead; i++)
+            push_read_job (priv);
+    }
 }
 
-static void
-ufo_read_task_get_requisition (UfoTask *task,
-                               UfoBuffer **inputs,
-                               UfoRequisition *requisition)
+static gboolean
+open_next_frame (UfoReadTaskPrivate *priv)
 {
-    UfoReadTaskPrivate *priv;
-    gsize width;
-    gsize height;
     const gchar *filename;
 
-    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
-
     if (priv->reader == NULL) {
-        filename = (gchar *) priv->current_element->data;
+        if (priv->current_index >= priv->filenames->len)
+            return FALSE;
+
+        filename = (gchar *) g_ptr_array_index (priv->filenames, priv->current_index);
         priv->reader = get_reader (priv, filename);
         ufo_reader_open (priv->reader, filename);
+
+        if (priv->single_file)
+            ufo_reader_skip (priv->reader, priv->start);
     }
 
     if (!ufo_reader_data_available (priv->reader)) {
         ufo_reader_close (priv->reader);
-        priv->current_element = g_list_nth (priv->current_element, priv->step);
+        priv->current_index += priv->step;
 
-        if (priv->current_element == NULL) {
-            priv->done = TRUE;
+        if (priv->current_index >= priv->filenames->len) {
             priv->reader = NULL;
-            return;
+            return FALSE;
         }
         else {
-            filename = (gchar *) priv->current_element->data;
+            filename = (gchar *) g_ptr_array_index (priv->filenames, priv->current_index);
             priv->reader = get_reader (priv, filename);
             ufo_reader_open (priv->reader, filename);
         }
     }
 
+    return TRUE;
+}
+
+static void
+get_frame_requisition (UfoReadTaskPrivate *priv, UfoRequisition *requisition)
+{
+    gsize width;
+    gsize height;
+
     ufo_reader_get_meta (priv->reader, &width, &height, &priv->depth);
 
+    if (priv->roi_x >= width) {
+        g_warning ("read: horizontal ROI start %i >= width %zu", priv->roi_x, width);
+        priv->roi_x = 0;
+    }
+
+    if (!priv->roi_width) {
+        priv->roi_width = width - priv->roi_x;
+    }
+    else {
+        if (priv->roi_x + priv->roi_width > width) {
+            g_warning ("read: horizontal ROI width %i >= width %zu", priv->roi_width, width);
+            priv->roi_width = width - priv->roi_x;
+        }
+    }
+
+    if (priv->sinograms) {
+        requisition->n_dims = 2;
+        requisition->dims[0] = get_num_samples (priv->roi_width, priv->roi_x_step);
+        requisition->dims[1] = height;
+        return;
+    }
+
     if (priv->roi_y >= height) {
         g_warning ("read: vertical ROI start %i >= height %zu", priv->roi_y, height);
         priv->roi_y = 0;
@@ -230,8 +736,207 @@ ufo_read_task_get_requisition (UfoTask *task,
     }
 
     requisition->n_dims = 2;
-    requisition->dims[0] = width;
-    requisition->dims[1] = priv->roi_height / priv->roi_step;
+    requisition->dims[0] = get_num_samples (priv->roi_width, priv->roi_x_step);
+    requisition->dims[1] = get_num_samples (priv->roi_height, priv->roi_step);
+}
+
+static gboolean
+is_converted_on_device (UfoReadTaskPrivate *priv)
+{
+    return priv->convert_on_device && priv->convert &&
+           (priv->depth == UFO_BUFFER_DEPTH_8U || priv->depth == UFO_BUFFER_DEPTH_16U);
+}
+
+static gsize
+get_sample_size (UfoReadTaskPrivate *priv)
+{
+    /* Frames that are converted on the device stay in their native depth */
+    if (is_converted_on_device (priv))
+        return priv->depth == UFO_BUFFER_DEPTH_8U ? sizeof (guint8) : sizeof (guint16);
+
+    return sizeof (gfloat);
+}
+
+static void
+read_frame (UfoReadTaskPrivate *priv, UfoBuffer *target, UfoRequisition *requisition)
+{
+    if (priv->sinograms)
+        ufo_reader_read (priv->reader, target, requisition,
+                         0, requisition->dims[1], 1,
+                         priv->roi_x, priv->roi_width, priv->roi_x_step);
+    else
+        ufo_reader_read (priv->reader, target, requisition,
+                         priv->roi_y, priv->roi_height, priv->roi_step,
+                         priv->roi_x, priv->roi_width, priv->roi_x_step);
+
+    if ((priv->depth != UFO_BUFFER_DEPTH_32F) && priv->convert && !is_converted_on_device (priv))
+        ufo_buffer_convert (target, priv->depth);
+
+    if (priv->single_file && priv->step > 1)
+        ufo_reader_skip (priv->reader, priv->step - 1);
+}
+
+static void
+convert_on_device (UfoTask *task, UfoBuffer *native, UfoBuffer *output, UfoRequisition *requisition)
+{
+    UfoReadTaskPrivate *priv;
+    UfoGpuNode *node;
+    UfoProfiler *profiler;
+    cl_command_queue cmd_queue;
+    cl_kernel kernel;
+    cl_mem out_mem;
+    gsize n_pixels;
+    gsize size;
+
+    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
+    node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+    cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+
+    n_pixels = requisition->dims[0] * requisition->dims[1];
+
+    if (requisition->n_dims == 3)
+        n_pixels *= requisition->dims[2];
+
+    size = n_pixels * get_sample_size (priv);
+    kernel = priv->depth == UFO_BUFFER_DEPTH_8U ? priv->convert_u8_kernel : priv->convert_u16_kernel;
+
+    if (priv->native_mem_size < size) {
+        cl_int err;
+
+        if (priv->native_mem != NULL)
+            UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->native_mem));
+
+        priv->native_mem = clCreateBuffer (priv->context, CL_MEM_READ_ONLY, size, NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+        priv->native_mem_size = size;
+    }
+
+    /* Only the compact samples cross the bus, the float image is never uploaded */
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueWriteBuffer (cmd_queue, priv->native_mem, CL_TRUE,
+                                                     0, size, ufo_buffer_get_host_array (native, NULL),
+                                                     0, NULL, NULL));
+
+    ufo_buffer_discard_location (output);
+    out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &priv->native_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_mem));
+
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    ufo_profiler_call (profiler, cmd_queue, kernel, 1, &n_pixels, NULL);
+}
+
+static guint
+fill_batch (UfoReadTaskPrivate *priv, UfoRequisition *requisition)
+{
+    UfoRequisition frame_requisition;
+    UfoRequisition batch_requisition;
+    gchar *data = NULL;
+    guint count;
+
+    for (count = 0; count < priv->batch && priv->current + count < priv->number; count++) {
+        UfoBuffer *slice;
+        gsize slice_size;
+
+        if (priv->pool != NULL) {
+            if (priv->frame == NULL)
+                priv->frame = pop_prefetched_frame (priv);
+
+            if (priv->frame == NULL)
+                break;
+
+            ufo_buffer_get_requisition (priv->frame, &frame_requisition);
+        }
+        else {
+            if (!open_next_frame (priv))
+                break;
+
+            get_frame_requisition (priv, &frame_requisition);
+        }
+
+        if (count == 0) {
+            *requisition = frame_requisition;
+            batch_requisition = frame_requisition;
+            batch_requisition.n_dims = 3;
+            batch_requisition.dims[2] = priv->batch;
+
+            if (priv->batch_buffer != NULL && ufo_buffer_cmp_dimensions (priv->batch_buffer, &batch_requisition)) {
+                g_object_unref (priv->batch_buffer);
+                priv->batch_buffer = NULL;
+            }
+
+            if (priv->batch_buffer == NULL)
+                priv->batch_buffer = new_frame_buffer (&batch_requisition);
+
+            data = (gchar *) ufo_buffer_get_host_array (priv->batch_buffer, NULL);
+        }
+        else if (frame_requisition.dims[0] != requisition->dims[0] ||
+                 frame_requisition.dims[1] != requisition->dims[1]) {
+            /* Frames of a different size start the next batch */
+            break;
+        }
+
+        /* Slices are packed, i.e. native frames are stored back to back */
+        slice_size = frame_requisition.dims[0] * frame_requisition.dims[1] * get_sample_size (priv);
+
+        if (priv->pool != NULL) {
+            memcpy (data + count * slice_size, ufo_buffer_get_host_array (priv->frame, NULL), slice_size);
+            g_object_unref (priv->frame);
+            priv->frame = NULL;
+            continue;
+        }
+
+        /* Let the reader write straight into the slice of the batch */
+        slice = ufo_buffer_new (&frame_requisition, NULL);
+        ufo_buffer_set_host_array (slice, data + count * slice_size, FALSE);
+        read_frame (priv, slice, &frame_requisition);
+        g_object_unref (slice);
+    }
+
+    if (count > 0) {
+        requisition->n_dims = 3;
+        requisition->dims[2] = count;
+    }
+
+    return count;
+}
+
+static void
+ufo_read_task_get_requisition (UfoTask *task,
+                               UfoBuffer **inputs,
+                               UfoRequisition *requisition)
+{
+    UfoReadTaskPrivate *priv;
+
+    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
+
+    if (priv->batch > 1) {
+        if (priv->current == priv->number || fill_batch (priv, requisition) == 0)
+            priv->done = TRUE;
+
+        return;
+    }
+
+    if (priv->pool != NULL) {
+        /* Do not open the remaining files once enough frames are read */
+        if (priv->frame == NULL && priv->current < priv->number)
+            priv->frame = pop_prefetched_frame (priv);
+
+        if (priv->frame == NULL) {
+            priv->done = TRUE;
+            return;
+        }
+
+        ufo_buffer_get_requisition (priv->frame, requisition);
+        return;
+    }
+
+    if (!open_next_frame (priv)) {
+        priv->done = TRUE;
+        return;
+    }
+
+    get_frame_requisition (priv, requisition);
 }
 
 static guint
@@ -250,7 +955,10 @@ ufo_read_task_get_num_dimensions (UfoTask *task,
 static UfoTaskMode
 ufo_read_task_get_mode (UfoTask *task)
 {
-    return UFO_TASK_MODE_GENERATOR | UFO_TASK_MODE_CPU;
+    UfoReadTaskPrivate *priv;
+
+    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
+    return UFO_TASK_MODE_GENERATOR | (priv->convert_on_device ? UFO_TASK_MODE_GPU : UFO_TASK_MODE_CPU);
 }
 
 static gboolean
@@ -265,10 +973,45 @@ ufo_read_task_generate (UfoTask *task,
     if (priv->current == priv->number || priv->done)
         return FALSE;
 
-    ufo_reader_read (priv->reader, output, requisition, priv->roi_y, priv->roi_height, priv->roi_step);
+    if (priv->batch > 1) {
+        if (is_converted_on_device (priv))
+            convert_on_device (task, priv->batch_buffer, output, requisition);
+        else {
+            /* The next batch is read into fresh memory */
+            hand_over_frame (priv->batch_buffer, output);
+            g_object_unref (priv->batch_buffer);
+            priv->batch_buffer = NULL;
+        }
+
+        priv->current += requisition->dims[2];
+        return TRUE;
+    }
+
+    if (priv->pool != NULL) {
+        if (is_converted_on_device (priv))
+            convert_on_device (task, priv->frame, output, requisition);
+        else
+            hand_over_frame (priv->frame, output);
 
-    if ((priv->depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
-        ufo_buffer_convert (output, priv->depth);
+        g_object_unref (priv->frame);
+        priv->frame = NULL;
+        priv->current++;
+        return TRUE;
+    }
+
+    if (is_converted_on_device (priv)) {
+        /* Keep the samples in native depth and stage them on the host */
+        if (priv->native == NULL)
+            priv->native = ufo_buffer_new (requisition, NULL);
+        else if (ufo_buffer_cmp_dimensions (priv->native, requisition))
+            ufo_buffer_resize (priv->native, requisition);
+
+        read_frame (priv, priv->native, requisition);
+        convert_on_device (task, priv->native, output, requisition);
+    }
+    else {
+        read_frame (priv, output, requisition);
+    }
 
     priv->current++;
     return TRUE;
@@ -287,6 +1030,10 @@ ufo_read_task_set_property (GObject *object,
             g_free (priv->path);
             priv->path = g_value_dup_string (value);
             break;
+        case PROP_INDEX:
+            g_free (priv->index_path);
+            priv->index_path = g_value_dup_string (value);
+            break;
         case PROP_STEP:
             priv->step = g_value_get_uint (value);
             break;
@@ -299,15 +1046,65 @@ ufo_read_task_set_property (GObject *object,
         case PROP_ROI_STEP:
             priv->roi_step = g_value_get_uint (value);
             break;
+        case PROP_ROI_X:
+            priv->roi_x = g_value_get_uint (value);
+            break;
+        case PROP_ROI_WIDTH:
+            priv->roi_width = g_value_get_uint (value);
+            break;
+        case PROP_ROI_X_STEP:
+            priv->roi_x_step = g_value_get_uint (value);
+            break;
         case PROP_CONVERT:
             priv->convert = g_value_get_boolean (value);
             break;
+        case PROP_CONVERT_ON_DEVICE:
+            priv->convert_on_device = g_value_get_boolean (value);
+            break;
+        case PROP_SINOGRAMS:
+            priv->sinograms = g_value_get_boolean (value);
+            break;
         case PROP_START:
             priv->start = g_value_get_uint (value);
             break;
         case PROP_NUMBER:
             priv->number = g_value_get_uint (value);
             break;
+        case PROP_READ_AHEAD:
+            priv->read_ahead = g_value_get_uint (value);
+            break;
+        case PROP_BATCH:
+            priv->batch = g_value_get_uint (value);
+            break;
+        case PROP_RAW_WIDTH:
+            priv->raw_width = g_value_get_uint (value);
+            break;
+        case PROP_RAW_HEIGHT:
+            priv->raw_height = g_value_get_uint (value);
+            break;
+        case PROP_RAW_BITDEPTH:
+            {
+                guint val = g_value_get_uint (value);
+
+                if (val != 8 && val != 16 && val != 32) {
+                    g_warning ("Read::raw-bitdepth can only 8, 16 or 32");
+                    return;
+                }
+
+                priv->raw_bitdepth = val;
+            }
+            break;
+        case PROP_RAW_OFFSET:
+            priv->raw_offset = g_value_get_uint (value);
+            break;
+#ifdef WITH_HDF5
+        case PROP_HDF5_BATCH_SIZE:
+            priv->hdf5_batch_size = g_value_get_uint (value);
+            break;
+        case PROP_HDF5_CHUNK_CACHE_SIZE:
+            priv->hdf5_chunk_cache_size = g_value_get_uint (value);
+            break;
+#endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -326,6 +1123,9 @@ ufo_read_task_get_property (GObject *object,
         case PROP_PATH:
             g_value_set_string (value, priv->path);
             break;
+        case PROP_INDEX:
+            g_value_set_string (value, priv->index_path);
+            break;
         case PROP_STEP:
             g_value_set_uint (value, priv->step);
             break;
@@ -338,15 +1138,56 @@ ufo_read_task_get_property (GObject *object,
         case PROP_ROI_STEP:
             g_value_set_uint (value, priv->roi_step);
             break;
+        case PROP_ROI_X:
+            g_value_set_uint (value, priv->roi_x);
+            break;
+        case PROP_ROI_WIDTH:
+            g_value_set_uint (value, priv->roi_width);
+            break;
+        case PROP_ROI_X_STEP:
+            g_value_set_uint (value, priv->roi_x_step);
+            break;
         case PROP_CONVERT:
             g_value_set_boolean (value, priv->convert);
             break;
+        case PROP_CONVERT_ON_DEVICE:
+            g_value_set_boolean (value, priv->convert_on_device);
+            break;
+        case PROP_SINOGRAMS:
+            g_value_set_boolean (value, priv->sinograms);
+            break;
         case PROP_START:
             g_value_set_uint (value, priv->start);
             break;
         case PROP_NUMBER:
             g_value_set_uint (value, priv->number);
             break;
+        case PROP_READ_AHEAD:
+            g_value_set_uint (value, priv->read_ahead);
+            break;
+        case PROP_BATCH:
+            g_value_set_uint (value, priv->batch);
+            break;
+        case PROP_RAW_WIDTH:
+            g_value_set_uint (value, priv->raw_width);
+            break;
+        case PROP_RAW_HEIGHT:
+            g_value_set_uint (value, priv->raw_height);
+            break;
+        case PROP_RAW_BITDEPTH:
+            g_value_set_uint (value, priv->raw_bitdepth);
+            break;
+        case PROP_RAW_OFFSET:
+            g_value_set_uint (value, priv->raw_offset);
+            break;
+#ifdef WITH_HDF5
+        case PROP_HDF5_BATCH_SIZE:
+            g_value_set_uint (value, priv->hdf5_batch_size);
+            break;
+        case PROP_HDF5_CHUNK_CACHE_SIZE:
+            g_value_set_uint (value, priv->hdf5_chunk_cache_size);
+            break;
+#endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -360,7 +1201,42 @@ ufo_read_task_dispose (GObject *object)
 
     priv = UFO_READ_TASK_GET_PRIVATE (object);
 
+    if (priv->pool != NULL) {
+        /* Stop jobs waiting for their frames to be taken and wait for all */
+        g_mutex_lock (&priv->lock);
+        priv->cancelled = TRUE;
+        g_cond_broadcast (&priv->frame_taken);
+        g_mutex_unlock (&priv->lock);
+
+        g_thread_pool_free (priv->pool, FALSE, TRUE);
+        priv->pool = NULL;
+
+        g_list_free_full (priv->jobs, (GDestroyNotify) free_read_job);
+        priv->jobs = NULL;
+
+        if (priv->job != NULL) {
+            free_read_job (priv->job);
+            priv->job = NULL;
+        }
+
+        if (priv->frame != NULL) {
+            g_object_unref (priv->frame);
+            priv->frame = NULL;
+        }
+    }
+
+    if (priv->native != NULL) {
+        g_object_unref (priv->native);
+        priv->native = NULL;
+    }
+
+    if (priv->batch_buffer != NULL) {
+        g_object_unref (priv->batch_buffer);
+        priv->batch_buffer = NULL;
+    }
+
     g_object_unref (priv->edf_reader);
+    g_object_unref (priv->raw_reader);
 
 #ifdef HAVE_TIFF
     g_object_unref (priv->tiff_reader);
@@ -381,11 +1257,38 @@ ufo_read_task_finalize (GObject *object)
     g_free (priv->path);
     priv->path = NULL;
 
+    g_mutex_clear (&priv->lock);
+    g_cond_clear (&priv->frame_ready);
+    g_cond_clear (&priv->frame_taken);
+
+    g_free (priv->index_path);
+    priv->index_path = NULL;
+
     if (priv->filenames != NULL) {
-        g_list_free_full (priv->filenames, (GDestroyNotify) g_free);
+        g_ptr_array_unref (priv->filenames);
         priv->filenames = NULL;
     }
 
+    if (priv->native_mem != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->native_mem));
+        priv->native_mem = NULL;
+    }
+
+    if (priv->convert_u8_kernel != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->convert_u8_kernel));
+        priv->convert_u8_kernel = NULL;
+    }
+
+    if (priv->convert_u16_kernel != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->convert_u16_kernel));
+        priv->convert_u16_kernel = NULL;
+    }
+
+    if (priv->context != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_read_task_parent_class)->finalize (object);
 }
 
@@ -417,6 +1320,13 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             "*.tif",
             G_PARAM_READWRITE);
 
+    properties[PROP_INDEX] =
+        g_param_spec_string("index",
+            "Path to a file index",
+            "Path to a file that caches the sorted list of matched files, it is rebuilt when the directory changes",
+            NULL,
+            G_PARAM_READWRITE);
+
     properties[PROP_STEP] =
         g_param_spec_uint("step",
         "Read every \"step\" file",
@@ -445,6 +1355,27 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             1, G_MAXUINT, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_ROI_X] =
+        g_param_spec_uint("x",
+            "Horizontal coordinate",
+            "Horizontal coordinate from where to start reading the image",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ROI_WIDTH] =
+        g_param_spec_uint("width",
+            "Width",
+            "Width of the region of interest to read",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ROI_X_STEP] =
+        g_param_spec_uint("x-step",
+            "Read every \"step\" column",
+            "Read every \"step\" column",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
     properties[PROP_CONVERT] =
         g_param_spec_boolean("enable-conversion",
             "Enable automatic conversion",
@@ -452,6 +1383,20 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             TRUE,
             G_PARAM_READWRITE);
 
+    properties[PROP_CONVERT_ON_DEVICE] =
+        g_param_spec_boolean("convert-on-device",
+            "Convert to float on the device",
+            "Upload 8 and 16 bit data in native depth and convert it to float on the GPU",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SINOGRAMS] =
+        g_param_spec_boolean("sinograms",
+            "Read sinograms instead of projections",
+            "Read sinograms of a three-dimensional volume, with y, height and y-step selecting the detector rows",
+            FALSE,
+            G_PARAM_READWRITE);
+
     properties[PROP_START] =
         g_param_spec_uint("start",
             "Offset to the first read file",
@@ -466,6 +1411,64 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             0, G_MAXUINT, G_MAXUINT,
             G_PARAM_READWRITE);
 
+    properties[PROP_READ_AHEAD] =
+        g_param_spec_uint("read-ahead",
+            "Number of files that are read ahead",
+            "Number of files that are opened and decoded ahead of time by as many worker threads, 0 disables read-ahead",
+            0, 256, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_BATCH] =
+        g_param_spec_uint("batch",
+            "Number of frames per output buffer",
+            "Number of consecutive frames that are packed into one three-dimensional output buffer, 1 produces two-dimensional frames",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_RAW_WIDTH] =
+        g_param_spec_uint("raw-width",
+            "Width of raw frames",
+            "Width of raw frames",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_RAW_HEIGHT] =
+        g_param_spec_uint("raw-height",
+            "Height of raw frames",
+            "Height of raw frames",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_RAW_BITDEPTH] =
+        g_param_spec_uint("raw-bitdepth",
+            "Bits per sample of raw frames",
+            "Bits per sample of raw frames. Possible values in [8, 16, 32].",
+            8, 32, 32,
+            G_PARAM_READWRITE);
+
+    properties[PROP_RAW_OFFSET] =
+        g_param_spec_uint("raw-offset",
+            "Offset to the first raw frame in bytes",
+            "Offset to the first raw frame in bytes, e.g. to skip a file header",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+#ifdef WITH_HDF5
+    properties[PROP_HDF5_BATCH_SIZE] =
+        g_param_spec_uint("hdf5-batch-size",
+            "Number of HDF5 frames read at once",
+            "Number of consecutive HDF5 frames that are read with a single hyperslab read",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_CHUNK_CACHE_SIZE] =
+        g_param_spec_uint("hdf5-chunk-cache-size",
+            "Size of the HDF5 chunk cache in MiB",
+            "Size of the HDF5 raw data chunk cache in MiB, 0 sizes it to hold all chunks of a batch",
+            0, G_MAXUINT >> 20, 0,
+            G_PARAM_READWRITE);
+#endif
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -479,16 +1482,35 @@ ufo_read_task_init(UfoReadTask *self)
 
     self->priv = priv = UFO_READ_TASK_GET_PRIVATE (self);
     priv->path = g_strdup (".");
+    priv->index_path = NULL;
+    priv->filenames = NULL;
+    priv->current_index = 0;
     priv->step = 1;
     priv->roi_y = 0;
     priv->roi_height = 0;
     priv->roi_step = 1;
+    priv->roi_x = 0;
+    priv->roi_width = 0;
+    priv->roi_x_step = 1;
     priv->convert = TRUE;
+    priv->convert_on_device = FALSE;
+    priv->context = NULL;
+    priv->convert_u8_kernel = NULL;
+    priv->convert_u16_kernel = NULL;
+    priv->native = NULL;
+    priv->native_mem = NULL;
+    priv->native_mem_size = 0;
+    priv->sinograms = FALSE;
     priv->start = 0;
     priv->number = G_MAXUINT;
     priv->depth = UFO_BUFFER_DEPTH_32F;
 
     priv->edf_reader = ufo_edf_reader_new ();
+    priv->raw_reader = ufo_raw_reader_new ();
+    priv->raw_width = 0;
+    priv->raw_height = 0;
+    priv->raw_bitdepth = 32;
+    priv->raw_offset = 0;
 
 #ifdef HAVE_TIFF
     priv->tiff_reader = ufo_tiff_reader_new ();
@@ -496,8 +1518,23 @@ ufo_read_task_init(UfoReadTask *self)
 
 #ifdef WITH_HDF5
     priv->hdf5_reader = ufo_hdf5_reader_new ();
+    priv->hdf5_batch_size = 1;
+    priv->hdf5_chunk_cache_size = 0;
 #endif
 
     priv->reader = NULL;
+    priv->single_file = FALSE;
     priv->done = FALSE;
+
+    priv->read_ahead = 0;
+    priv->pool = NULL;
+    priv->jobs = NULL;
+    priv->next_index = 0;
+    priv->job = NULL;
+    priv->frame = NULL;
+    priv->batch = 1;
+    priv->batch_buffer = NULL;
+    g_mutex_init (&priv->lock);
+    g_cond_init (&priv->frame_ready);
+    g_cond_init (&priv->frame_taken);
 }
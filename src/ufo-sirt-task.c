@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "ufo-sirt-task.h"
+
+/*
+ * The slice, the measured sinogram, the residual of the current subset and
+ * the column weights stay on the device for all iterations. Projections are
+ * split into interleaved subsets, subset s holding projections s, s + n,
+ * s + 2n, ... Their angles are stored subset by subset in the lookup tables,
+ * so each subset is a contiguous range for forwardproject_residual and
+ * backproject_tex.
+ */
+struct _UfoSirtTaskPrivate {
+    cl_context context;
+    cl_kernel residual_kernel;
+    cl_kernel backproject_kernel;
+    cl_kernel clear_kernel;
+    cl_kernel update_kernel;
+    cl_mem sin_lut;
+    cl_mem cos_lut;
+    cl_mem slice_image;
+    cl_mem residual_mem;
+    cl_mem residual_image;
+    cl_mem correction_mem;
+    cl_mem weights_mem;
+    guint *subset_offsets;
+    guint n_subsets;
+    guint max_subset_size;
+    guint width;
+    guint n_projections;
+    guint num_iterations;
+    guint num_subsets;
+    gfloat relaxation;
+    gdouble angle_step;
+    gdouble angle_offset;
+};
+
+static void ufo_task_interface_init (UfoTaskIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UfoSirtTask, ufo_sirt_task, UFO_TYPE_TASK_NODE,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
+                                                ufo_task_interface_init))
+
+#define UFO_SIRT_TASK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_SIRT_TASK, UfoSirtTaskPrivate))
+
+enum {
+    PROP_0,
+    PROP_NUM_ITERATIONS,
+    PROP_NUM_SUBSETS,
+    PROP_RELAXATION_FACTOR,
+    PROP_ANGLE_STEP,
+    PROP_ANGLE_OFFSET,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+UfoNode *
+ufo_sirt_task_new (void)
+{
+    return UFO_NODE (g_object_new (UFO_TYPE_SIRT_TASK, NULL));
+}
+
+static void
+release_mem (cl_mem *mem)
+{
+    if (*mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (*mem));
+        *mem = NULL;
+    }
+}
+
+static void
+release_kernel (cl_kernel *kernel)
+{
+    if (*kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (*kernel));
+        *kernel = NULL;
+    }
+}
+
+static void
+release_geometry (UfoSirtTaskPrivate *priv)
+{
+    release_mem (&priv->sin_lut);
+    release_mem (&priv->cos_lut);
+    release_mem (&priv->slice_image);
+    release_mem (&priv->residual_mem);
+    release_mem (&priv->residual_image);
+    release_mem (&priv->correction_mem);
+    release_mem (&priv->weights_mem);
+
+    g_free (priv->subset_offsets);
+    priv->subset_offsets = NULL;
+}
+
+static cl_mem
+create_buffer (UfoSirtTaskPrivate *priv, gsize size, cl_mem_flags flags, gpointer host_mem)
+{
+    cl_int errcode;
+    cl_mem mem;
+
+    mem = clCreateBuffer (priv->context, flags, size, host_mem, &errcode);
+    UFO_RESOURCES_CHECK_CLERR (errcode);
+    return mem;
+}
+
+static cl_mem
+create_image (UfoSirtTaskPrivate *priv, gsize width, gsize height, cl_mem_flags flags, gpointer host_mem)
+{
+    cl_image_format format;
+    cl_int errcode;
+    cl_mem mem;
+
+    format.image_channel_order = CL_R;
+    format.image_channel_data_type = CL_FLOAT;
+
+    mem = clCreateImage2D (priv->context, flags, &format, width, height, 0, host_mem, &errcode);
+    UFO_RESOURCES_CHECK_CLERR (errcode);
+    return mem;
+}
+
+static void
+create_geometry (UfoSirtTaskPrivate *priv)
+{
+    gfloat *sin_lut;
+    gfloat *cos_lut;
+    gdouble angle_step;
+    gsize lut_size;
+    guint k = 0;
+
+    priv->n_subsets = MIN (priv->num_subsets, priv->n_projections);
+    priv->subset_offsets = g_new0 (guint, priv->n_subsets + 1);
+    priv->max_subset_size = (priv->n_projections + priv->n_subsets - 1) / priv->n_subsets;
+
+    lut_size = priv->n_projections * sizeof (gfloat);
+    sin_lut = g_malloc (lut_size);
+    cos_lut = g_malloc (lut_size);
+    angle_step = priv->angle_step > 0.0 ? priv->angle_step : G_PI / priv->n_projections;
+
+    for (guint s = 0; s < priv->n_subsets; s++) {
+        for (guint proj = s; proj < priv->n_projections; proj += priv->n_subsets, k++) {
+            sin_lut[k] = (gfloat) sin (priv->angle_offset + proj * angle_step);
+            cos_lut[k] = (gfloat) cos (priv->angle_offset + proj * angle_step);
+        }
+
+        priv->subset_offsets[s + 1] = k;
+    }
+
+    priv->sin_lut = create_buffer (priv, lut_size, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sin_lut);
+    priv->cos_lut = create_buffer (priv, lut_size, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, cos_lut);
+    g_free (sin_lut);
+    g_free (cos_lut);
+
+    priv->slice_image = create_image (priv, priv->width, priv->width, CL_MEM_READ_ONLY, NULL);
+    priv->residual_image = create_image (priv, priv->width, priv->max_subset_size, CL_MEM_READ_ONLY, NULL);
+    priv->residual_mem = create_buffer (priv, priv->width * priv->max_subset_size * sizeof (gfloat),
+                                        CL_MEM_READ_WRITE, NULL);
+    priv->correction_mem = create_buffer (priv, priv->width * priv->width * sizeof (gfloat),
+                                          CL_MEM_READ_WRITE, NULL);
+}
+
+static void
+backproject (UfoSirtTaskPrivate *priv,
+             cl_command_queue cmd_queue,
+             UfoProfiler *profiler,
+             cl_mem sinogram,
+             cl_mem slice,
+             guint offset,
+             guint n_projections)
+{
+    gsize global_size[2] = { priv->width, priv->width };
+    gfloat axis_pos = priv->width / 2.0f;
+    gfloat origin = 0.0f;
+    gfloat step = 1.0f;
+    cl_kernel kernel = priv->backproject_kernel;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &sinogram));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &slice));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &priv->sin_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (cl_mem), &priv->cos_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (guint),  &offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (guint),  &n_projections));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (gfloat), &axis_pos));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 7, sizeof (guint),  &priv->width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (gfloat), &origin));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 9, sizeof (gfloat), &origin));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 10, sizeof (gfloat), &step));
+    ufo_profiler_call (profiler, cmd_queue, kernel, 2, global_size, NULL);
+}
+
+/*
+ * The column sums of the backprojector are the backprojection of a sinogram
+ * of ones over all projections. They are computed once per geometry, a
+ * subset of m projections is normalised with m / n_projections of them.
+ */
+static void
+compute_weights (UfoSirtTaskPrivate *priv,
+                 cl_command_queue cmd_queue,
+                 UfoProfiler *profiler)
+{
+    gsize n_elements = priv->width * priv->n_projections;
+    gfloat *ones;
+    cl_mem ones_image;
+
+    ones = g_malloc (n_elements * sizeof (gfloat));
+
+    for (gsize i = 0; i < n_elements; i++)
+        ones[i] = 1.0f;
+
+    ones_image = create_image (priv, priv->width, priv->n_projections,
+                               CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, ones);
+    g_free (ones);
+
+    priv->weights_mem = create_buffer (priv, priv->width * priv->width * sizeof (gfloat),
+                                       CL_MEM_READ_WRITE, NULL);
+
+    backproject (priv, cmd_queue, profiler, ones_image, priv->weights_mem, 0, priv->n_projections);
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (ones_image));
+}
+
+static void
+copy_to_image (cl_command_queue cmd_queue, cl_mem src, cl_mem dst, gsize width, gsize height)
+{
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyBufferToImage (cmd_queue, src, dst, 0, origin, region,
+                                                           0, NULL, NULL));
+}
+
+static void
+ufo_sirt_task_setup (UfoTask *task,
+                     UfoResources *resources,
+                     GError **error)
+{
+    UfoSirtTaskPrivate *priv;
+
+    priv = UFO_SIRT_TASK_GET_PRIVATE (task);
+    priv->context = ufo_resources_get_context (resources);
+
+    priv->residual_kernel = ufo_resources_get_kernel (resources, "forwardproject.cl", "forwardproject_residual", error);
+    priv->backproject_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex", error);
+    priv->clear_kernel = ufo_resources_get_kernel (resources, "sirt.cl", "sirt_clear", error);
+    priv->update_kernel = ufo_resources_get_kernel (resources, "sirt.cl", "sirt_update", error);
+
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
+
+    if (priv->residual_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->residual_kernel));
+
+    if (priv->backproject_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->backproject_kernel));
+
+    if (priv->clear_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->clear_kernel));
+
+    if (priv->update_kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->update_kernel));
+}
+
+static void
+ufo_sirt_task_get_requisition (UfoTask *task,
+                               UfoBuffer **inputs,
+                               UfoRequisition *requisition)
+{
+    UfoSirtTaskPrivate *priv;
+    UfoRequisition in_req;
+
+    priv = UFO_SIRT_TASK_GET_PRIVATE (task);
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+
+    if (priv->width != in_req.dims[0] || priv->n_projections != in_req.dims[1] ||
+        priv->subset_offsets == NULL) {
+        release_geometry (priv);
+        priv->width = (guint) in_req.dims[0];
+        priv->n_projections = (guint) in_req.dims[1];
+        create_geometry (priv);
+    }
+
+    requisition->n_dims = 2;
+    requisition->dims[0] = in_req.dims[0];
+    requisition->dims[1] = in_req.dims[0];
+}
+
+static guint
+ufo_sirt_task_get_num_inputs (UfoTask *task)
+{
+    return 1;
+}
+
+static guint
+ufo_sirt_task_get_num_dimensions (UfoTask *task,
+                                  guint input)
+{
+    g_return_val_if_fail (input == 0, 0);
+    return 2;
+}
+
+static UfoTaskMode
+ufo_sirt_task_get_mode (UfoTask *task)
+{
+    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
+}
+
+static gboolean
+ufo_sirt_task_process (UfoTask *task,
+                       UfoBuffer **inputs,
+                       UfoBuffer *output,
+                       UfoRequisition *requisition)
+{
+    UfoSirtTaskPrivate *priv;
+    UfoGpuNode *node;
+    UfoProfiler *profiler;
+    cl_command_queue cmd_queue;
+    cl_mem sino_mem;
+    cl_mem slice_mem;
+    gsize n_pixels;
+
+    priv = UFO_SIRT_TASK (task)->priv;
+    node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+    cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+
+    sino_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
+    slice_mem = ufo_buffer_get_device_array (output, cmd_queue);
+    n_pixels = priv->width * priv->width;
+
+    if (priv->weights_mem == NULL)
+        compute_weights (priv, cmd_queue, profiler);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->clear_kernel, 0, sizeof (cl_mem), &slice_mem));
+    ufo_profiler_call (profiler, cmd_queue, priv->clear_kernel, 1, &n_pixels, NULL);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 0, sizeof (cl_mem), &priv->slice_image));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 1, sizeof (cl_mem), &sino_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 2, sizeof (cl_mem), &priv->residual_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 3, sizeof (cl_mem), &priv->sin_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 4, sizeof (cl_mem), &priv->cos_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 7, sizeof (guint), &priv->n_subsets));
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->update_kernel, 0, sizeof (cl_mem), &slice_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->update_kernel, 1, sizeof (cl_mem), &priv->correction_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->update_kernel, 2, sizeof (cl_mem), &priv->weights_mem));
+
+    for (guint i = 0; i < priv->num_iterations; i++) {
+        for (guint s = 0; s < priv->n_subsets; s++) {
+            guint offset = priv->subset_offsets[s];
+            guint size = priv->subset_offsets[s + 1] - offset;
+            gsize residual_size[2] = { priv->width, size };
+            gfloat scale = priv->relaxation * priv->n_projections / size;
+
+            copy_to_image (cmd_queue, slice_mem, priv->slice_image, priv->width, priv->width);
+
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 5, sizeof (guint), &offset));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->residual_kernel, 6, sizeof (guint), &s));
+            ufo_profiler_call (profiler, cmd_queue, priv->residual_kernel, 2, residual_size, NULL);
+
+            copy_to_image (cmd_queue, priv->residual_mem, priv->residual_image, priv->width, size);
+            backproject (priv, cmd_queue, profiler, priv->residual_image, priv->correction_mem, offset, size);
+
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->update_kernel, 3, sizeof (gfloat), &scale));
+            ufo_profiler_call (profiler, cmd_queue, priv->update_kernel, 1, &n_pixels, NULL);
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+ufo_sirt_task_set_property (GObject *object,
+                            guint property_id,
+                            const GValue *value,
+                            GParamSpec *pspec)
+{
+    UfoSirtTaskPrivate *priv = UFO_SIRT_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_NUM_ITERATIONS:
+            priv->num_iterations = g_value_get_uint (value);
+            break;
+        case PROP_NUM_SUBSETS:
+            priv->num_subsets = g_value_get_uint (value);
+            release_geometry (priv);
+            break;
+        case PROP_RELAXATION_FACTOR:
+            priv->relaxation = g_value_get_float (value);
+            break;
+        case PROP_ANGLE_STEP:
+            priv->angle_step = g_value_get_double (value);
+            release_geometry (priv);
+            break;
+        case PROP_ANGLE_OFFSET:
+            priv->angle_offset = g_value_get_double (value);
+            release_geometry (priv);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_sirt_task_get_property (GObject *object,
+                            guint property_id,
+                            GValue *value,
+                            GParamSpec *pspec)
+{
+    UfoSirtTaskPrivate *priv = UFO_SIRT_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_NUM_ITERATIONS:
+            g_value_set_uint (value, priv->num_iterations);
+            break;
+        case PROP_NUM_SUBSETS:
+            g_value_set_uint (value, priv->num_subsets);
+            break;
+        case PROP_RELAXATION_FACTOR:
+            g_value_set_float (value, priv->relaxation);
+            break;
+        case PROP_ANGLE_STEP:
+            g_value_set_double (value, priv->angle_step);
+            break;
+        case PROP_ANGLE_OFFSET:
+            g_value_set_double (value, priv->angle_offset);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_sirt_task_finalize (GObject *object)
+{
+    UfoSirtTaskPrivate *priv;
+
+    priv = UFO_SIRT_TASK_GET_PRIVATE (object);
+
+    release_geometry (priv);
+    release_kernel (&priv->residual_kernel);
+    release_kernel (&priv->backproject_kernel);
+    release_kernel (&priv->clear_kernel);
+    release_kernel (&priv->update_kernel);
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
+    G_OBJECT_CLASS (ufo_sirt_task_parent_class)->finalize (object);
+}
+
+static void
+ufo_task_interface_init (UfoTaskIface *iface)
+{
+    iface->setup = ufo_sirt_task_setup;
+    iface->get_requisition = ufo_sirt_task_get_requisition;
+    iface->get_num_inputs = ufo_sirt_task_get_num_inputs;
+    iface->get_num_dimensions = ufo_sirt_task_get_num_dimensions;
+    iface->get_mode = ufo_sirt_task_get_mode;
+    iface->process = ufo_sirt_task_process;
+}
+
+static void
+ufo_sirt_task_class_init (UfoSirtTaskClass *klass)
+{
+    GObjectClass *oclass = G_OBJECT_CLASS (klass);
+    const gdouble limit = 4.0 * G_PI;
+
+    oclass->set_property = ufo_sirt_task_set_property;
+    oclass->get_property = ufo_sirt_task_get_property;
+    oclass->finalize = ufo_sirt_task_finalize;
+
+    properties[PROP_NUM_ITERATIONS] =
+        g_param_spec_uint ("num-iterations",
+                           "Number of iterations",
+                           "Number of iterations",
+                           0, 10000, 10,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_NUM_SUBSETS] =
+        g_param_spec_uint ("num-subsets",
+                           "Number of ordered subsets the projections are split into",
+                           "Number of ordered subsets the projections are split into",
+                           1, 8192, 1,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_RELAXATION_FACTOR] =
+        g_param_spec_float ("relaxation-factor",
+                            "Relaxation factor of each update",
+                            "Relaxation factor of each update",
+                            0.0f, 2.0f, 1.0f,
+                            G_PARAM_READWRITE);
+
+    properties[PROP_ANGLE_STEP] =
+        g_param_spec_double ("angle-step",
+                             "Increment of angle in radians",
+                             "Increment of angle in radians",
+                             -limit, +limit, 0.0,
+                             G_PARAM_READWRITE);
+
+    properties[PROP_ANGLE_OFFSET] =
+        g_param_spec_double ("angle-offset",
+                             "Angle offset in radians",
+                             "Angle offset in radians determining the first angle position",
+                             0.0, +limit, 0.0,
+                             G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (oclass, i, properties[i]);
+
+    g_type_class_add_private (oclass, sizeof(UfoSirtTaskPrivate));
+}
+
+static void
+ufo_sirt_task_init(UfoSirtTask *self)
+{
+    self->priv = UFO_SIRT_TASK_GET_PRIVATE(self);
+    self->priv->num_iterations = 10;
+    self->priv->num_subsets = 1;
+    self->priv->relaxation = 1.0f;
+    self->priv->angle_step = 0.0;
+    self->priv->angle_offset = 0.0;
+}
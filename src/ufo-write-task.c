@@ -19,6 +19,7 @@
 
 #include <gmodule.h>
 #include <errno.h>
+#include <string.h>
 
 #include "config.h"
 #include "ufo-write-task.h"
@@ -35,8 +36,26 @@
 
 #ifdef WITH_HDF5
 #include "writers/ufo-hdf5-writer.h"
+#include "common/hdf5.h"
 #endif
 
+typedef struct {
+    gpointer        data;
+    gsize           size;
+    UfoRequisition  requisition;
+    guint           counter;
+    gboolean        finish;
+} WriteFrame;
+
+typedef struct {
+    UfoWriteTaskPrivate *priv;
+    UfoWriter           *writer;
+    GThread             *thread;
+    GAsyncQueue         *pending;
+    const gchar         *pattern;
+    gboolean             opened;
+} WriteThread;
+
 struct _UfoWriteTaskPrivate {
     gchar *filename;
     guint counter;
@@ -48,20 +67,57 @@ struct _UfoWriteTaskPrivate {
     gboolean multi_file;
     gboolean opened;
 
+    guint          queue_size;
+    guint          n_threads;
+    GAsyncQueue   *free_frames;
+    GAsyncQueue   *pending_frames;
+    WriteThread   *threads;
+    guint          n_running;
+    gboolean       write_at;
+
+    gchar         *shards;
+    guint          shard_count;
+    guint          num_shards;
+    gchar         *shard_manifest;
+    gchar        **shard_patterns;
+    guint          first_counter;
+
+    guint          pyramid_levels;
+    gfloat         minimum;
+    gfloat         maximum;
+    guint          range_frames;
+    gfloat         range_min;
+    gfloat         range_max;
+    GPtrArray     *held_frames;
+    gboolean       quantized;
+    UfoBufferDepth quantized_depth;
+
+    guint          raw_num_frames;
+    guint          raw_buffer_size;
+    gboolean       raw_direct;
+
     UfoWriter     *writer;
     UfoRawWriter  *raw_writer;
 
 #ifdef HAVE_TIFF
     UfoTiffWriter *tiff_writer;
+    gboolean       tiff_bigtiff;
+    gchar         *tiff_compression;
 #endif
 
 #ifdef HAVE_JPEG
     UfoJpegWriter *jpeg_writer;
     gint           quality;
+    guint          jpeg_threads;
 #endif
 
 #ifdef WITH_HDF5
     UfoHdf5Writer *hdf5_writer;
+    guint          hdf5_chunk_frames;
+    guint          hdf5_chunk_height;
+    guint          hdf5_chunk_width;
+    gboolean       hdf5_shuffle;
+    guint          hdf5_deflate;
 #endif
 };
 
@@ -78,8 +134,32 @@ enum {
     PROP_FILENAME,
     PROP_APPEND,
     PROP_BITS,
+    PROP_QUEUE_SIZE,
+    PROP_WRITE_THREADS,
+    PROP_SHARDS,
+    PROP_NUM_SHARDS,
+    PROP_SHARD_MANIFEST,
+    PROP_PYRAMID_LEVELS,
+    PROP_MINIMUM,
+    PROP_MAXIMUM,
+    PROP_RANGE_FRAMES,
+    PROP_RAW_NUM_FRAMES,
+    PROP_RAW_BUFFER_SIZE,
+    PROP_RAW_DIRECT,
+#ifdef HAVE_TIFF
+    PROP_TIFF_BIGTIFF,
+    PROP_TIFF_COMPRESSION,
+#endif
 #ifdef HAVE_JPEG
     PROP_QUALITY,
+    PROP_JPEG_THREADS,
+#endif
+#ifdef WITH_HDF5
+    PROP_HDF5_CHUNK_FRAMES,
+    PROP_HDF5_CHUNK_HEIGHT,
+    PROP_HDF5_CHUNK_WIDTH,
+    PROP_HDF5_SHUFFLE,
+    PROP_HDF5_DEFLATE,
 #endif
     N_PROPERTIES
 };
@@ -93,12 +173,266 @@ ufo_write_task_new (void)
 }
 
 static gchar *
-get_current_filename (UfoWriteTaskPrivate *priv)
+get_filename (UfoWriteTaskPrivate *priv, const gchar *pattern, guint counter)
 {
     if (priv->multi_file)
-        return g_strdup (priv->filename);
+        return g_strdup (pattern);
+
+    return g_strdup_printf (pattern, counter);
+}
+
+static void
+make_image (UfoWriteTaskPrivate *priv,
+            UfoWriterImage *image,
+            gpointer data,
+            UfoRequisition *requisition)
+{
+    image->data = data;
+    image->requisition = requisition;
+    image->depth = priv->quantized ? priv->quantized_depth : priv->depth;
+    image->min = priv->range_min;
+    image->max = priv->range_max;
+    image->quantized = priv->quantized;
+}
+
+static void
+write_frames (UfoWriteTaskPrivate *priv,
+              UfoWriter *writer,
+              const gchar *pattern,
+              gboolean *opened,
+              gpointer data,
+              UfoRequisition *requisition,
+              guint n_frames,
+              gsize stride,
+              guint counter)
+{
+    UfoWriterImage image;
+
+    if (!priv->multi_file || !*opened) {
+        gchar *filename = get_filename (priv, pattern, counter);
+        ufo_writer_open (writer, filename);
+        g_free (filename);
+        *opened = TRUE;
+    }
+
+    make_image (priv, &image, data, requisition);
+
+    if (n_frames == 1)
+        ufo_writer_write (writer, &image);
+    else
+        ufo_writer_write_many (writer, &image, n_frames, stride);
+
+    if (!priv->multi_file) {
+        ufo_writer_close (writer);
+        *opened = FALSE;
+    }
+}
+
+static gpointer
+write_thread_run (WriteThread *thread)
+{
+    UfoWriteTaskPrivate *priv = thread->priv;
+
+    while (TRUE) {
+        WriteFrame *frame = (WriteFrame *) g_async_queue_pop (thread->pending);
+
+        if (frame->finish) {
+            g_free (frame);
+            break;
+        }
+
+        if (priv->write_at) {
+            UfoWriterImage image;
+
+            make_image (priv, &image, frame->data, &frame->requisition);
+            ufo_raw_writer_write_at (UFO_RAW_WRITER (thread->writer), &image, frame->counter);
+        }
+        else
+            write_frames (priv, thread->writer, thread->pattern, &thread->opened,
+                          frame->data, &frame->requisition, 1, 0, frame->counter);
+
+        /* Hand the frame back, which unblocks process if the queue was full */
+        g_async_queue_push (priv->free_frames, frame);
+    }
+
+    if (thread->opened) {
+        ufo_writer_close (thread->writer);
+        thread->opened = FALSE;
+    }
 
-    return g_strdup_printf (priv->filename, priv->counter);
+    return NULL;
+}
+
+#ifdef HAVE_JPEG
+/* Encoding threads need a file per frame, frames of a single file are encoded in order */
+static guint
+get_jpeg_threads (UfoWriteTaskPrivate *priv)
+{
+    return priv->multi_file ? 1 : priv->jpeg_threads;
+}
+#endif
+
+static UfoWriter *
+create_writer (UfoWriteTaskPrivate *priv)
+{
+    UfoWriter *writer;
+
+    writer = UFO_WRITER (g_object_new (G_OBJECT_TYPE (priv->writer), NULL));
+
+    if (UFO_IS_RAW_WRITER (writer)) {
+        ufo_raw_writer_set_buffer_size (UFO_RAW_WRITER (writer), ((gsize) priv->raw_buffer_size) << 20);
+        ufo_raw_writer_set_direct (UFO_RAW_WRITER (writer), priv->raw_direct);
+    }
+
+#ifdef HAVE_TIFF
+    if (UFO_IS_TIFF_WRITER (writer)) {
+        ufo_tiff_writer_set_levels (UFO_TIFF_WRITER (writer), priv->pyramid_levels);
+        ufo_tiff_writer_set_bigtiff (UFO_TIFF_WRITER (writer), priv->tiff_bigtiff);
+        ufo_tiff_writer_set_compression (UFO_TIFF_WRITER (writer), priv->tiff_compression);
+    }
+#endif
+
+#ifdef HAVE_JPEG
+    if (UFO_IS_JPEG_WRITER (writer)) {
+        ufo_jpeg_writer_set_quality (UFO_JPEG_WRITER (writer), priv->quality);
+        ufo_jpeg_writer_set_num_threads (UFO_JPEG_WRITER (writer), get_jpeg_threads (priv));
+    }
+#endif
+
+#ifdef WITH_HDF5
+    if (UFO_IS_HDF5_WRITER (writer)) {
+        ufo_hdf5_writer_set_levels (UFO_HDF5_WRITER (writer), priv->pyramid_levels);
+        ufo_hdf5_writer_set_chunks (UFO_HDF5_WRITER (writer), priv->hdf5_chunk_frames,
+                                    priv->hdf5_chunk_height, priv->hdf5_chunk_width);
+        ufo_hdf5_writer_set_shuffle (UFO_HDF5_WRITER (writer), priv->hdf5_shuffle);
+        ufo_hdf5_writer_set_deflate (UFO_HDF5_WRITER (writer), priv->hdf5_deflate);
+    }
+#endif
+
+    return writer;
+}
+
+static void
+start_write_threads (UfoWriteTaskPrivate *priv)
+{
+    guint queue_size;
+
+    priv->free_frames = g_async_queue_new ();
+    priv->pending_frames = g_async_queue_new ();
+
+    /* Shards need queued frames, keep at least two per shard in flight */
+    queue_size = MAX (priv->queue_size, 2 * priv->num_shards);
+
+    for (guint i = 0; i < queue_size; i++)
+        g_async_queue_push (priv->free_frames, g_new0 (WriteFrame, 1));
+
+    /*
+     * Frames of a single file must be written in order by a single thread,
+     * except for raw files where each frame has a known offset. Each shard is
+     * written by its own thread from its own queue.
+     */
+    if (priv->num_shards > 0) {
+        priv->write_at = FALSE;
+        priv->n_running = priv->num_shards;
+    }
+    else {
+        priv->write_at = priv->multi_file && UFO_IS_RAW_WRITER (priv->writer);
+        priv->n_running = priv->multi_file && !priv->write_at ? 1 : priv->n_threads;
+
+#ifdef WITH_HDF5
+        /* Writers must not call into a library that is not thread-safe concurrently */
+        if (UFO_IS_HDF5_WRITER (priv->writer) && !ufo_hdf5_is_threadsafe ())
+            priv->n_running = 1;
+#endif
+    }
+
+    priv->threads = g_new0 (WriteThread, priv->n_running);
+
+    if (priv->write_at) {
+        gchar *filename = get_filename (priv, priv->filename, priv->counter);
+        ufo_writer_open (priv->writer, filename);
+        g_free (filename);
+    }
+
+    for (guint i = 0; i < priv->n_running; i++) {
+        WriteThread *thread = &priv->threads[i];
+
+        thread->priv = priv;
+        thread->writer = i == 0 || priv->write_at ? g_object_ref (priv->writer) : create_writer (priv);
+
+        if (priv->num_shards > 0) {
+            thread->pattern = priv->shard_patterns[i];
+            thread->pending = g_async_queue_new ();
+        }
+        else {
+            thread->pattern = priv->filename;
+            thread->pending = g_async_queue_ref (priv->pending_frames);
+        }
+
+        thread->thread = g_thread_new ("write", (GThreadFunc) write_thread_run, thread);
+    }
+}
+
+static void
+write_shard_manifest (UfoWriteTaskPrivate *priv)
+{
+    GString *manifest;
+    GError *error = NULL;
+
+    manifest = g_string_new ("# ufo-write-shards\n");
+    g_string_append (manifest, "# frame first + i is frame i / shards of shard i % shards\n");
+    g_string_append_printf (manifest, "shards %u\n", priv->num_shards);
+    g_string_append_printf (manifest, "first %u\n", priv->first_counter);
+    g_string_append_printf (manifest, "frames %u\n", priv->counter - priv->first_counter);
+
+    for (guint i = 0; i < priv->num_shards; i++)
+        g_string_append_printf (manifest, "%u %s\n", i, priv->shard_patterns[i]);
+
+    if (!g_file_set_contents (priv->shard_manifest, manifest->str, (gssize) manifest->len, &error)) {
+        g_warning ("write: cannot write shard manifest: %s", error->message);
+        g_error_free (error);
+    }
+
+    g_string_free (manifest, TRUE);
+}
+
+static void
+stop_write_threads (UfoWriteTaskPrivate *priv)
+{
+    WriteFrame *frame;
+
+    if (priv->threads == NULL)
+        return;
+
+    /* Each thread finishes the frames queued before its end marker */
+    for (guint i = 0; i < priv->n_running; i++) {
+        frame = g_new0 (WriteFrame, 1);
+        frame->finish = TRUE;
+        g_async_queue_push (priv->threads[i].pending, frame);
+    }
+
+    for (guint i = 0; i < priv->n_running; i++) {
+        g_thread_join (priv->threads[i].thread);
+        g_object_unref (priv->threads[i].writer);
+        g_async_queue_unref (priv->threads[i].pending);
+    }
+
+    if (priv->write_at)
+        ufo_writer_close (priv->writer);
+
+    if (priv->num_shards > 0)
+        write_shard_manifest (priv);
+
+    while ((frame = (WriteFrame *) g_async_queue_try_pop (priv->free_frames)) != NULL) {
+        g_free (frame->data);
+        g_free (frame);
+    }
+
+    g_async_queue_unref (priv->free_frames);
+    g_async_queue_unref (priv->pending_frames);
+    g_free (priv->threads);
+    priv->threads = NULL;
+    priv->n_running = 0;
 }
 
 static guint
@@ -114,6 +448,108 @@ count_format_specifiers (const gchar *filename)
     return count;
 }
 
+static gboolean
+make_directory (const gchar *dirname, GError **error)
+{
+    if (!g_file_test (dirname, G_FILE_TEST_EXISTS)) {
+        g_debug ("write: `%s' does not exist. Attempt to create it.", dirname);
+
+        if (g_mkdir_with_parents (dirname, 0755)) {
+            g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                         "Could not create `%s'.", dirname);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+setup_shards (UfoWriteTaskPrivate *priv,
+              guint num_fmt_specifiers,
+              GError **error)
+{
+    gchar **entries;
+    gchar **components;
+    gchar *basename;
+    guint n_entries;
+    gboolean success = TRUE;
+
+    entries = g_strsplit (priv->shards, ",", 0);
+    n_entries = g_strv_length (entries);
+    priv->num_shards = priv->shard_count > 0 ? priv->shard_count : n_entries;
+
+    if (priv->multi_file && priv->num_shards > n_entries) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "%u shards of a single file need as many entries in `%s'",
+                     priv->num_shards, priv->shards);
+        g_strfreev (entries);
+        return FALSE;
+    }
+
+#ifdef WITH_HDF5
+    /* Each shard has its own writer thread, which a stock libhdf5 does not allow */
+    if (UFO_IS_HDF5_WRITER (priv->writer) && priv->num_shards > 1 && !ufo_hdf5_is_threadsafe ()) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "HDF5 shards need a thread-safe build of libhdf5");
+        g_strfreev (entries);
+        return FALSE;
+    }
+#endif
+
+    /* Directories get the file name, for HDF5 including the dataset */
+    components = g_strsplit (priv->filename, ":", 2);
+    basename = g_path_get_basename (components[0]);
+
+    if (components[1] != NULL) {
+        gchar *tmp = basename;
+        basename = g_strconcat (tmp, ":", components[1], NULL);
+        g_free (tmp);
+    }
+
+    g_strfreev (components);
+    g_strfreev (priv->shard_patterns);
+    priv->shard_patterns = g_new0 (gchar *, priv->num_shards + 1);
+
+    for (guint i = 0; i < priv->num_shards && success; i++) {
+        const gchar *entry = g_strstrip (entries[i % n_entries]);
+        gchar *dirname;
+
+        if (g_str_has_suffix (entry, G_DIR_SEPARATOR_S) || g_file_test (entry, G_FILE_TEST_IS_DIR))
+            priv->shard_patterns[i] = g_build_filename (entry, basename, NULL);
+        else
+            priv->shard_patterns[i] = g_strdup (entry);
+
+        if (count_format_specifiers (priv->shard_patterns[i]) != num_fmt_specifiers ||
+            !ufo_writer_can_open (priv->writer, priv->shard_patterns[i])) {
+            g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                         "Shard `%s' does not match `%s'", priv->shard_patterns[i], priv->filename);
+            success = FALSE;
+            break;
+        }
+
+        components = g_strsplit (priv->shard_patterns[i], ":", 2);
+        dirname = g_path_get_dirname (components[0]);
+        success = make_directory (dirname, error);
+        g_strfreev (components);
+        g_free (dirname);
+    }
+
+    if (success && priv->shard_manifest == NULL) {
+        gchar *dirname;
+
+        components = g_strsplit (priv->filename, ":", 2);
+        dirname = g_path_get_dirname (components[0]);
+        priv->shard_manifest = g_build_filename (dirname, "shards.txt", NULL);
+        g_strfreev (components);
+        g_free (dirname);
+    }
+
+    g_free (basename);
+    g_strfreev (entries);
+    return success;
+}
+
 static void
 ufo_write_task_setup (UfoTask *task,
                       UfoResources *resources,
@@ -122,6 +558,7 @@ ufo_write_task_setup (UfoTask *task,
     UfoWriteTaskPrivate *priv;
     gchar *dirname;
     guint num_fmt_specifiers;
+    gboolean supports_levels = FALSE;
 
     priv = UFO_WRITE_TASK_GET_PRIVATE (task);
     num_fmt_specifiers = count_format_specifiers (priv->filename);
@@ -141,6 +578,7 @@ ufo_write_task_setup (UfoTask *task,
 #ifdef HAVE_TIFF
     else if (ufo_writer_can_open (UFO_WRITER (priv->tiff_writer), priv->filename)) {
         priv->writer = UFO_WRITER (priv->tiff_writer);
+        supports_levels = TRUE;
     }
 #endif
 #ifdef WITH_HDF5
@@ -148,6 +586,7 @@ ufo_write_task_setup (UfoTask *task,
         gchar **components;
 
         priv->writer = UFO_WRITER (priv->hdf5_writer);
+        supports_levels = TRUE;
 
         /*
          * dirname will be wrong because we use path separators for the dataset.
@@ -162,6 +601,7 @@ ufo_write_task_setup (UfoTask *task,
 #ifdef HAVE_JPEG
     else if (ufo_writer_can_open (UFO_WRITER (priv->jpeg_writer), priv->filename)) {
         priv->writer = UFO_WRITER (priv->jpeg_writer);
+        ufo_jpeg_writer_set_num_threads (priv->jpeg_writer, get_jpeg_threads (priv));
     }
 #endif
     else {
@@ -170,12 +610,17 @@ ufo_write_task_setup (UfoTask *task,
         return;
     }
 
-    if (!g_file_test (dirname, G_FILE_TEST_EXISTS)) {
-        g_debug ("write: `%s' does not exist. Attempt to create it.", dirname);
+    if (priv->pyramid_levels > 0 && !supports_levels)
+        g_warning ("write: `%s' cannot store downsampled levels", priv->filename);
 
-        if (g_mkdir_with_parents (dirname, 0755)) {
-            g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
-                         "Could not create `%s'.", dirname);
+    if (!make_directory (dirname, error))
+        return;
+
+    priv->num_shards = 0;
+
+    if (priv->shards != NULL && priv->shards[0] != '\0') {
+        if (!setup_shards (priv, num_fmt_specifiers, error)) {
+            g_free (dirname);
             return;
         }
     }
@@ -186,7 +631,7 @@ ufo_write_task_setup (UfoTask *task,
         gboolean exists = TRUE;
 
         while (exists) {
-            gchar *filename = get_current_filename (priv);
+            gchar *filename = get_filename (priv, priv->filename, priv->counter);
             exists = g_file_test (filename, G_FILE_TEST_EXISTS);
             g_free (filename);
 
@@ -196,6 +641,17 @@ ufo_write_task_setup (UfoTask *task,
     }
 
     g_free (dirname);
+    priv->first_counter = priv->counter;
+
+    priv->range_min = priv->minimum;
+    priv->range_max = priv->maximum;
+
+    /* Without a given range, hold frames back until their range is known */
+    if (priv->minimum >= priv->maximum && priv->range_frames > 0 && priv->held_frames == NULL)
+        priv->held_frames = g_ptr_array_new ();
+
+    if (priv->queue_size > 0 || priv->num_shards > 0)
+        start_write_threads (priv);
 }
 
 static void
@@ -226,6 +682,110 @@ ufo_write_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_SINK | UFO_TASK_MODE_CPU;
 }
 
+static void
+dispatch_frame (UfoWriteTaskPrivate *priv,
+                gpointer data,
+                UfoRequisition *requisition,
+                gsize size,
+                guint counter)
+{
+    if (priv->threads != NULL) {
+        WriteFrame *frame;
+
+        /* Blocks until a writer thread returns a frame if all are queued */
+        frame = (WriteFrame *) g_async_queue_pop (priv->free_frames);
+
+        if (frame->size < size) {
+            g_free (frame->data);
+            frame->data = g_malloc (size);
+            frame->size = size;
+        }
+
+        memcpy (frame->data, data, size);
+        frame->requisition = *requisition;
+        frame->counter = counter;
+
+        if (priv->num_shards > 0)
+            g_async_queue_push (priv->threads[(counter - priv->first_counter) % priv->num_shards].pending, frame);
+        else
+            g_async_queue_push (priv->pending_frames, frame);
+    }
+    else {
+        write_frames (priv, priv->writer, priv->filename, &priv->opened, data, requisition, 1, 0, counter);
+    }
+}
+
+/*
+ * The quantize task emits packed 8- or 16-bit samples and keeps the frame
+ * dimensions as metadata. These are written without converting again.
+ */
+static gboolean
+get_quantized_frame (UfoWriteTaskPrivate *priv,
+                     UfoBuffer *buffer,
+                     UfoRequisition *requisition)
+{
+    GValue *bits;
+    GValue *width;
+    GValue *height;
+
+    bits = ufo_buffer_get_metadata (buffer, "quantize-bits");
+    width = ufo_buffer_get_metadata (buffer, "quantize-width");
+    height = ufo_buffer_get_metadata (buffer, "quantize-height");
+
+    if (bits == NULL || width == NULL || height == NULL)
+        return FALSE;
+
+    if (!priv->quantized) {
+        if (priv->pyramid_levels > 0)
+            g_warning ("write: cannot downsample quantized input, writing no levels");
+
+        /* The range was already applied on the device */
+        if (priv->held_frames != NULL && priv->held_frames->len == 0) {
+            g_ptr_array_free (priv->held_frames, TRUE);
+            priv->held_frames = NULL;
+        }
+
+        priv->quantized = TRUE;
+    }
+
+    priv->quantized_depth = g_value_get_uint (bits) == 8 ? UFO_BUFFER_DEPTH_8U : UFO_BUFFER_DEPTH_16U;
+    requisition->n_dims = 2;
+    requisition->dims[0] = g_value_get_uint (width);
+    requisition->dims[1] = g_value_get_uint (height);
+    return TRUE;
+}
+
+static void
+release_held_frames (UfoWriteTaskPrivate *priv)
+{
+    gfloat min = G_MAXFLOAT;
+    gfloat max = -G_MAXFLOAT;
+
+    /* The range of the first frames is used for all frames */
+    for (guint i = 0; i < priv->held_frames->len; i++) {
+        WriteFrame *frame = g_ptr_array_index (priv->held_frames, i);
+        gfloat frame_min, frame_max;
+
+        ufo_writer_get_min_max (frame->data, &frame->requisition, &frame_min, &frame_max);
+        min = MIN (min, frame_min);
+        max = MAX (max, frame_max);
+    }
+
+    priv->range_min = min;
+    priv->range_max = max;
+
+    for (guint i = 0; i < priv->held_frames->len; i++) {
+        WriteFrame *frame = g_ptr_array_index (priv->held_frames, i);
+
+        dispatch_frame (priv, frame->data, &frame->requisition, frame->size, frame->counter);
+        g_free (frame->data);
+        g_free (frame);
+    }
+
+    g_ptr_array_free (priv->held_frames, TRUE);
+    priv->held_frames = NULL;
+}
+
 static gboolean
 ufo_write_task_process (UfoTask *task,
                         UfoBuffer **inputs,
@@ -234,6 +794,7 @@ ufo_write_task_process (UfoTask *task,
 {
     UfoWriteTaskPrivate *priv;
     UfoRequisition in_req;
+    UfoRequisition frame_req;
     guint8 *data;
     guint num_frames;
     gsize offset;
@@ -245,19 +806,43 @@ ufo_write_task_process (UfoTask *task,
     num_frames = in_req.n_dims == 3 ? in_req.dims[2] : 1;
     offset = ufo_buffer_get_size (inputs[0]) / num_frames;
 
-    for (guint i = 0; i < num_frames; i++) {
-        if (!priv->multi_file || !priv->opened) {
-            gchar *filename = get_current_filename (priv);
-            ufo_writer_open (priv->writer, filename);
-            g_free (filename);
-            priv->opened = TRUE;
-        }
+    /* Writers get one frame at a time */
+    frame_req = in_req;
+    frame_req.n_dims = 2;
+
+    if (get_quantized_frame (priv, inputs[0], &frame_req)) {
+        num_frames = 1;
+        offset = frame_req.dims[0] * frame_req.dims[1] * (priv->quantized_depth == UFO_BUFFER_DEPTH_8U ? 1 : 2);
+    }
 
-        ufo_writer_write (priv->writer, data + i * offset, &in_req, priv->depth);
+    /*
+     * Without threads or held frames a multi-frame file can take the whole
+     * stack in one call.
+     */
+    if (num_frames > 1 && priv->multi_file && priv->threads == NULL && priv->held_frames == NULL) {
+        write_frames (priv, priv->writer, priv->filename, &priv->opened,
+                      data, &frame_req, num_frames, offset, priv->counter);
+        priv->counter += num_frames;
+        return TRUE;
+    }
 
-        if (!priv->multi_file) {
-            ufo_writer_close (priv->writer);
-            priv->opened = FALSE;
+    for (guint i = 0; i < num_frames; i++) {
+        if (priv->held_frames != NULL) {
+            WriteFrame *frame;
+
+            frame = g_new0 (WriteFrame, 1);
+            frame->data = g_malloc (offset);
+            frame->size = offset;
+            frame->requisition = frame_req;
+            frame->counter = priv->counter;
+            memcpy (frame->data, data + i * offset, offset);
+            g_ptr_array_add (priv->held_frames, frame);
+
+            if (priv->held_frames->len == priv->range_frames)
+                release_held_frames (priv);
+        }
+        else {
+            dispatch_frame (priv, data + i * offset, &frame_req, offset, priv->counter);
         }
 
         priv->counter++;
@@ -301,11 +886,101 @@ ufo_write_task_set_property (GObject *object,
                     priv->depth = UFO_BUFFER_DEPTH_32F;
             }
             break;
+        case PROP_QUEUE_SIZE:
+            priv->queue_size = g_value_get_uint (value);
+            break;
+        case PROP_WRITE_THREADS:
+            priv->n_threads = g_value_get_uint (value);
+            break;
+        case PROP_SHARDS:
+            g_free (priv->shards);
+            priv->shards = g_value_dup_string (value);
+            break;
+        case PROP_NUM_SHARDS:
+            priv->shard_count = g_value_get_uint (value);
+            break;
+        case PROP_SHARD_MANIFEST:
+            g_free (priv->shard_manifest);
+            priv->shard_manifest = g_value_dup_string (value);
+            break;
+        case PROP_PYRAMID_LEVELS:
+            priv->pyramid_levels = g_value_get_uint (value);
+#ifdef HAVE_TIFF
+            ufo_tiff_writer_set_levels (priv->tiff_writer, priv->pyramid_levels);
+#endif
+#ifdef WITH_HDF5
+            ufo_hdf5_writer_set_levels (priv->hdf5_writer, priv->pyramid_levels);
+#endif
+            break;
+        case PROP_MINIMUM:
+            priv->minimum = g_value_get_float (value);
+            break;
+        case PROP_MAXIMUM:
+            priv->maximum = g_value_get_float (value);
+            break;
+        case PROP_RANGE_FRAMES:
+            priv->range_frames = g_value_get_uint (value);
+            break;
+        case PROP_RAW_NUM_FRAMES:
+            priv->raw_num_frames = g_value_get_uint (value);
+            ufo_raw_writer_set_num_frames (priv->raw_writer, priv->raw_num_frames);
+            break;
+        case PROP_RAW_BUFFER_SIZE:
+            priv->raw_buffer_size = g_value_get_uint (value);
+            ufo_raw_writer_set_buffer_size (priv->raw_writer, ((gsize) priv->raw_buffer_size) << 20);
+            break;
+        case PROP_RAW_DIRECT:
+            priv->raw_direct = g_value_get_boolean (value);
+            ufo_raw_writer_set_direct (priv->raw_writer, priv->raw_direct);
+            break;
+#ifdef HAVE_TIFF
+        case PROP_TIFF_BIGTIFF:
+            priv->tiff_bigtiff = g_value_get_boolean (value);
+            ufo_tiff_writer_set_bigtiff (priv->tiff_writer, priv->tiff_bigtiff);
+            break;
+        case PROP_TIFF_COMPRESSION:
+            if (!ufo_tiff_writer_set_compression (priv->tiff_writer, g_value_get_string (value))) {
+                g_warning ("write: TIFF compression `%s' is not supported", g_value_get_string (value));
+                break;
+            }
+
+            g_free (priv->tiff_compression);
+            priv->tiff_compression = g_value_dup_string (value);
+            break;
+#endif
 #ifdef HAVE_JPEG
         case PROP_QUALITY:
             priv->quality = g_value_get_uint (value);
             ufo_jpeg_writer_set_quality (priv->jpeg_writer, priv->quality);
             break;
+        case PROP_JPEG_THREADS:
+            priv->jpeg_threads = g_value_get_uint (value);
+            break;
+#endif
+#ifdef WITH_HDF5
+        case PROP_HDF5_CHUNK_FRAMES:
+            priv->hdf5_chunk_frames = g_value_get_uint (value);
+            ufo_hdf5_writer_set_chunks (priv->hdf5_writer, priv->hdf5_chunk_frames,
+                                        priv->hdf5_chunk_height, priv->hdf5_chunk_width);
+            break;
+        case PROP_HDF5_CHUNK_HEIGHT:
+            priv->hdf5_chunk_height = g_value_get_uint (value);
+            ufo_hdf5_writer_set_chunks (priv->hdf5_writer, priv->hdf5_chunk_frames,
+                                        priv->hdf5_chunk_height, priv->hdf5_chunk_width);
+            break;
+        case PROP_HDF5_CHUNK_WIDTH:
+            priv->hdf5_chunk_width = g_value_get_uint (value);
+            ufo_hdf5_writer_set_chunks (priv->hdf5_writer, priv->hdf5_chunk_frames,
+                                        priv->hdf5_chunk_height, priv->hdf5_chunk_width);
+            break;
+        case PROP_HDF5_SHUFFLE:
+            priv->hdf5_shuffle = g_value_get_boolean (value);
+            ufo_hdf5_writer_set_shuffle (priv->hdf5_writer, priv->hdf5_shuffle);
+            break;
+        case PROP_HDF5_DEFLATE:
+            priv->hdf5_deflate = g_value_get_uint (value);
+            ufo_hdf5_writer_set_deflate (priv->hdf5_writer, priv->hdf5_deflate);
+            break;
 #endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -338,10 +1013,74 @@ ufo_write_task_get_property (GObject *object,
             if (priv->depth == UFO_BUFFER_DEPTH_32F)
                 g_value_set_uint (value, 32);
             break;
+        case PROP_QUEUE_SIZE:
+            g_value_set_uint (value, priv->queue_size);
+            break;
+        case PROP_WRITE_THREADS:
+            g_value_set_uint (value, priv->n_threads);
+            break;
+        case PROP_SHARDS:
+            g_value_set_string (value, priv->shards);
+            break;
+        case PROP_NUM_SHARDS:
+            g_value_set_uint (value, priv->shard_count);
+            break;
+        case PROP_SHARD_MANIFEST:
+            g_value_set_string (value, priv->shard_manifest);
+            break;
+        case PROP_PYRAMID_LEVELS:
+            g_value_set_uint (value, priv->pyramid_levels);
+            break;
+        case PROP_MINIMUM:
+            g_value_set_float (value, priv->minimum);
+            break;
+        case PROP_MAXIMUM:
+            g_value_set_float (value, priv->maximum);
+            break;
+        case PROP_RANGE_FRAMES:
+            g_value_set_uint (value, priv->range_frames);
+            break;
+        case PROP_RAW_NUM_FRAMES:
+            g_value_set_uint (value, priv->raw_num_frames);
+            break;
+        case PROP_RAW_BUFFER_SIZE:
+            g_value_set_uint (value, priv->raw_buffer_size);
+            break;
+        case PROP_RAW_DIRECT:
+            g_value_set_boolean (value, priv->raw_direct);
+            break;
+#ifdef HAVE_TIFF
+        case PROP_TIFF_BIGTIFF:
+            g_value_set_boolean (value, priv->tiff_bigtiff);
+            break;
+        case PROP_TIFF_COMPRESSION:
+            g_value_set_string (value, priv->tiff_compression);
+            break;
+#endif
 #ifdef HAVE_JPEG
         case PROP_QUALITY:
             g_value_set_uint (value, priv->quality);
             break;
+        case PROP_JPEG_THREADS:
+            g_value_set_uint (value, priv->jpeg_threads);
+            break;
+#endif
+#ifdef WITH_HDF5
+        case PROP_HDF5_CHUNK_FRAMES:
+            g_value_set_uint (value, priv->hdf5_chunk_frames);
+            break;
+        case PROP_HDF5_CHUNK_HEIGHT:
+            g_value_set_uint (value, priv->hdf5_chunk_height);
+            break;
+        case PROP_HDF5_CHUNK_WIDTH:
+            g_value_set_uint (value, priv->hdf5_chunk_width);
+            break;
+        case PROP_HDF5_SHUFFLE:
+            g_value_set_boolean (value, priv->hdf5_shuffle);
+            break;
+        case PROP_HDF5_DEFLATE:
+            g_value_set_uint (value, priv->hdf5_deflate);
+            break;
 #endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -356,6 +1095,13 @@ ufo_write_task_dispose (GObject *object)
 
     priv = UFO_WRITE_TASK_GET_PRIVATE (object);
 
+    /* Less frames than range-frames arrived, write them with their range */
+    if (priv->held_frames != NULL)
+        release_held_frames (priv);
+
+    /* Drain the queue so that all frames are on disk */
+    stop_write_threads (priv);
+
     g_object_unref (priv->raw_writer);
 
 #ifdef HAVE_TIFF
@@ -386,6 +1132,14 @@ ufo_write_task_finalize (GObject *object)
     g_free (priv->filename);
     priv->filename= NULL;
 
+    g_free (priv->shards);
+    g_free (priv->shard_manifest);
+    g_strfreev (priv->shard_patterns);
+
+#ifdef HAVE_TIFF
+    g_free (priv->tiff_compression);
+#endif
+
     G_OBJECT_CLASS (ufo_write_task_parent_class)->finalize (object);
 }
 
@@ -430,12 +1184,139 @@ ufo_write_task_class_init (UfoWriteTaskClass *klass)
                            "Number of bits per sample. Possible values in [8, 16, 32].",
                            8, 32, 32, G_PARAM_READWRITE);
 
+    properties[PROP_QUEUE_SIZE] =
+        g_param_spec_uint ("queue-size",
+                           "Number of frames queued for writing",
+                           "Number of frames that are copied and queued for background writer threads, 0 writes synchronously",
+                           0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_WRITE_THREADS] =
+        g_param_spec_uint ("write-threads",
+                           "Number of writer threads",
+                           "Number of background writer threads if frames are queued, a single file other than raw is written by one thread",
+                           1, 64, 1, G_PARAM_READWRITE);
+
+    properties[PROP_SHARDS] =
+        g_param_spec_string ("shards",
+                             "Comma-separated shard filenames or directories",
+                             "Comma-separated filenames or directories across which frames are distributed, frame i goes to shard i modulo the number of shards",
+                             NULL,
+                             G_PARAM_READWRITE);
+
+    properties[PROP_NUM_SHARDS] =
+        g_param_spec_uint ("num-shards",
+                           "Number of shards",
+                           "Number of shards, entries of shards are reused cyclically, 0 uses one shard per entry",
+                           0, 1024, 0, G_PARAM_READWRITE);
+
+    properties[PROP_SHARD_MANIFEST] =
+        g_param_spec_string ("shard-manifest",
+                             "Filename of the shard manifest",
+                             "Filename of the manifest describing the frame to shard mapping, by default shards.txt next to filename",
+                             NULL,
+                             G_PARAM_READWRITE);
+
+    properties[PROP_PYRAMID_LEVELS] =
+        g_param_spec_uint ("pyramid-levels",
+                           "Number of downsampled levels",
+                           "Number of additional levels, each downsampled by two, stored as HDF5 datasets or TIFF sub directories",
+                           0, 6, 0, G_PARAM_READWRITE);
+
+    properties[PROP_MINIMUM] =
+        g_param_spec_float ("minimum",
+                            "Value mapped to zero",
+                            "Value mapped to zero when converting to integer bit depths, used if smaller than maximum",
+                            -G_MAXFLOAT, G_MAXFLOAT, 0.0f, G_PARAM_READWRITE);
+
+    properties[PROP_MAXIMUM] =
+        g_param_spec_float ("maximum",
+                            "Value mapped to the largest integer",
+                            "Value mapped to the largest integer when converting to integer bit depths, used if larger than minimum",
+                            -G_MAXFLOAT, G_MAXFLOAT, 0.0f, G_PARAM_READWRITE);
+
+    properties[PROP_RANGE_FRAMES] =
+        g_param_spec_uint ("range-frames",
+                           "Number of frames determining the range",
+                           "Number of first frames whose range is used to convert all frames if no range is given, 0 converts each frame with its own range",
+                           0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_RAW_NUM_FRAMES] =
+        g_param_spec_uint ("raw-num-frames",
+                           "Expected number of frames in a raw file",
+                           "Expected number of frames of a single raw file, used to preallocate it, 0 disables preallocation",
+                           0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_RAW_BUFFER_SIZE] =
+        g_param_spec_uint ("raw-buffer-size",
+                           "Size of the raw write buffer in MiB",
+                           "Size of the buffer in MiB in which raw frames are coalesced before writing, 0 writes each frame directly",
+                           0, 4096, 0, G_PARAM_READWRITE);
+
+    properties[PROP_RAW_DIRECT] =
+        g_param_spec_boolean ("raw-direct",
+                              "Use direct I/O for raw files",
+                              "Bypass the page cache with O_DIRECT when writing raw files",
+                              FALSE, G_PARAM_READWRITE);
+
+#ifdef HAVE_TIFF
+    properties[PROP_TIFF_BIGTIFF] =
+        g_param_spec_boolean ("tiff-bigtiff",
+                              "Write BigTIFF files",
+                              "Write BigTIFF files, which can grow beyond 4 GB",
+                              FALSE, G_PARAM_READWRITE);
+
+    properties[PROP_TIFF_COMPRESSION] =
+        g_param_spec_string ("tiff-compression",
+                             "TIFF compression",
+                             "TIFF compression, one of \"none\", \"deflate\", \"lzw\" and \"zstd\"",
+                             "none",
+                             G_PARAM_READWRITE);
+#endif
+
 #ifdef HAVE_JPEG
     properties[PROP_QUALITY] =
         g_param_spec_uint ("quality",
                            "JPEG quality",
                            "JPEG quality between 0 and 100",
                            0, 100, 95, G_PARAM_READWRITE);
+
+    properties[PROP_JPEG_THREADS] =
+        g_param_spec_uint ("jpeg-threads",
+                           "Number of JPEG encoding threads",
+                           "Number of threads encoding JPEG frames in the background, files may be completed out of order",
+                           1, 256, 1, G_PARAM_READWRITE);
+#endif
+
+#ifdef WITH_HDF5
+    properties[PROP_HDF5_CHUNK_FRAMES] =
+        g_param_spec_uint ("hdf5-chunk-frames",
+                           "Number of frames per HDF5 chunk",
+                           "Number of frames per HDF5 chunk, frames are collected and written one chunk row at a time",
+                           1, 4096, 1, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_CHUNK_HEIGHT] =
+        g_param_spec_uint ("hdf5-chunk-height",
+                           "Height of an HDF5 chunk",
+                           "Height of an HDF5 chunk, 0 uses the frame height",
+                           0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_CHUNK_WIDTH] =
+        g_param_spec_uint ("hdf5-chunk-width",
+                           "Width of an HDF5 chunk",
+                           "Width of an HDF5 chunk, 0 uses the frame width",
+                           0, G_MAXUINT, 0, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_SHUFFLE] =
+        g_param_spec_boolean ("hdf5-shuffle",
+                              "Apply the HDF5 shuffle filter",
+                              "Reorder bytes before compression with the HDF5 shuffle filter",
+                              FALSE, G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_DEFLATE] =
+        g_param_spec_uint ("hdf5-deflate",
+                           "HDF5 deflate level",
+                           "Deflate compression level between 1 and 9, 0 disables compression",
+                           0, 9, 0, G_PARAM_READWRITE);
 #endif
 
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
@@ -454,10 +1335,36 @@ ufo_write_task_init(UfoWriteTask *self)
     self->priv->depth = UFO_BUFFER_DEPTH_32F;
     self->priv->writer = NULL;
     self->priv->opened = FALSE;
+    self->priv->queue_size = 0;
+    self->priv->n_threads = 1;
+    self->priv->free_frames = NULL;
+    self->priv->pending_frames = NULL;
+    self->priv->threads = NULL;
+    self->priv->n_running = 0;
+    self->priv->write_at = FALSE;
+    self->priv->shards = NULL;
+    self->priv->shard_count = 0;
+    self->priv->num_shards = 0;
+    self->priv->shard_manifest = NULL;
+    self->priv->shard_patterns = NULL;
+    self->priv->first_counter = 0;
+    self->priv->pyramid_levels = 0;
+    self->priv->minimum = 0.0f;
+    self->priv->maximum = 0.0f;
+    self->priv->range_frames = 0;
+    self->priv->range_min = 0.0f;
+    self->priv->range_max = 0.0f;
+    self->priv->held_frames = NULL;
+    self->priv->quantized = FALSE;
+    self->priv->raw_num_frames = 0;
+    self->priv->raw_buffer_size = 0;
+    self->priv->raw_direct = FALSE;
     self->priv->raw_writer = ufo_raw_writer_new ();
 
 #ifdef HAVE_TIFF
     self->priv->tiff_writer = ufo_tiff_writer_new ();
+    self->priv->tiff_bigtiff = FALSE;
+    self->priv->tiff_compression = g_strdup ("none");
     self->priv->filename = g_strdup ("./output-%05i.tif");
 #else
     self->priv->filename = g_strdup ("./output-%05i.raw");
@@ -466,9 +1373,15 @@ ufo_write_task_init(UfoWriteTask *self)
 #ifdef HAVE_JPEG
     self->priv->jpeg_writer = ufo_jpeg_writer_new ();
     self->priv->quality = 95;
+    self->priv->jpeg_threads = 1;
 #endif
 
 #ifdef WITH_HDF5
     self->priv->hdf5_writer = ufo_hdf5_writer_new ();
+    self->priv->hdf5_chunk_frames = 1;
+    self->priv->hdf5_chunk_height = 0;
+    self->priv->hdf5_chunk_width = 0;
+    self->priv->hdf5_shuffle = FALSE;
+    self->priv->hdf5_deflate = 0;
 #endif
 }
@@ -17,16 +17,44 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include "common/hdf5.h"
 #include "writers/ufo-writer.h"
 #include "writers/ufo-hdf5-writer.h"
 
 
+#define MAX_LEVELS 6
+
+/* Dataset of one resolution level, level 0 is the full resolution */
+typedef struct {
+    gchar *name;
+    hid_t dataset_id;
+    hsize_t frame_dims[2];
+    gsize frame_size;
+    guint8 *frames;
+    gfloat *pixels;
+    UfoRequisition requisition;
+} Level;
+
 struct _UfoHdf5WriterPrivate {
     gchar *dataset;
     hid_t file_id;
-    hid_t dataset_id;
     guint current;
+
+    Level levels[MAX_LEVELS + 1];
+    guint n_levels;
+    guint n_active;
+
+    /* Chunk shape, zero height or width means full frame extent */
+    guint chunk_frames;
+    guint chunk_height;
+    guint chunk_width;
+    gboolean shuffle;
+    guint deflate;
+
+    /* Frames collected until a complete row of chunks can be written */
+    guint n_buffered;
+    hid_t mem_type;
 };
 
 static void ufo_writer_interface_init (UfoWriterIface *iface);
@@ -43,6 +71,75 @@ ufo_hdf5_writer_new (void)
     return g_object_new (UFO_TYPE_HDF5_WRITER, NULL);
 }
 
+/**
+ * ufo_hdf5_writer_set_chunks:
+ * @writer: A #UfoHdf5Writer
+ * @frames: Number of frames per chunk
+ * @height: Chunk height or 0 for the frame height
+ * @width: Chunk width or 0 for the frame width
+ *
+ * Set the chunk shape of newly created datasets. Frames are collected until
+ * @frames of them are available and then written with a single call, so that
+ * each chunk is compressed only once.
+ */
+void
+ufo_hdf5_writer_set_chunks (UfoHdf5Writer *writer,
+                            guint frames,
+                            guint height,
+                            guint width)
+{
+    UfoHdf5WriterPrivate *priv;
+
+    g_return_if_fail (UFO_IS_HDF5_WRITER (writer));
+    priv = UFO_HDF5_WRITER_GET_PRIVATE (writer);
+    priv->chunk_frames = MAX (frames, 1);
+    priv->chunk_height = height;
+    priv->chunk_width = width;
+}
+
+/**
+ * ufo_hdf5_writer_set_shuffle:
+ * @writer: A #UfoHdf5Writer
+ * @shuffle: %TRUE to apply the byte shuffle filter
+ */
+void
+ufo_hdf5_writer_set_shuffle (UfoHdf5Writer *writer,
+                             gboolean shuffle)
+{
+    g_return_if_fail (UFO_IS_HDF5_WRITER (writer));
+    UFO_HDF5_WRITER_GET_PRIVATE (writer)->shuffle = shuffle;
+}
+
+/**
+ * ufo_hdf5_writer_set_deflate:
+ * @writer: A #UfoHdf5Writer
+ * @level: Deflate level between 1 and 9 or 0 to disable compression
+ */
+void
+ufo_hdf5_writer_set_deflate (UfoHdf5Writer *writer,
+                             guint level)
+{
+    g_return_if_fail (UFO_IS_HDF5_WRITER (writer));
+    UFO_HDF5_WRITER_GET_PRIVATE (writer)->deflate = MIN (level, 9);
+}
+
+/**
+ * ufo_hdf5_writer_set_levels:
+ * @writer: A #UfoHdf5Writer
+ * @n_levels: Number of downsampled levels
+ *
+ * Write @n_levels additional datasets next to the full resolution one, each
+ * downsampled by two from the previous one. For a dataset "name" they are
+ * called "name-2x", "name-4x" and so on.
+ */
+void
+ufo_hdf5_writer_set_levels (UfoHdf5Writer *writer,
+                            guint n_levels)
+{
+    g_return_if_fail (UFO_IS_HDF5_WRITER (writer));
+    UFO_HDF5_WRITER_GET_PRIVATE (writer)->n_levels = MIN (n_levels, MAX_LEVELS);
+}
+
 static gboolean
 ufo_hdf5_writer_can_open (UfoWriter *writer,
                           const gchar *filename)
@@ -76,17 +173,9 @@ ufo_hdf5_writer_open (UfoWriter *writer,
         priv->file_id = H5Fcreate (h5_filename, H5F_ACC_EXCL, H5P_DEFAULT, H5P_DEFAULT);
 
     g_strfreev (components);
+    priv->n_active = 0;
     priv->current = 0;
-}
-
-static void
-ufo_hdf5_writer_close (UfoWriter *writer)
-{
-    UfoHdf5WriterPrivate *priv;
-
-    priv = UFO_HDF5_WRITER_GET_PRIVATE (writer);
-    H5Dclose (priv->dataset_id);
-    H5Fclose (priv->file_id);
+    priv->n_buffered = 0;
 }
 
 static hid_t
@@ -170,61 +259,229 @@ buffer_depth_to_hdf5_type (UfoBufferDepth depth)
     }
 }
 
+static gsize
+bytes_per_sample (UfoBufferDepth depth)
+{
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            return 1;
+        case UFO_BUFFER_DEPTH_16U:
+        case UFO_BUFFER_DEPTH_16S:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
 static void
-ufo_hdf5_writer_write (UfoWriter *writer,
-                       gpointer data,
-                       UfoRequisition *requisition,
-                       UfoBufferDepth depth)
+create_dataset (UfoHdf5WriterPrivate *priv, Level *level)
+{
+    hid_t group_id;
+    hid_t dataspace_id;
+    hid_t dcpl;
+    hsize_t dims[3] = { 0, level->frame_dims[0], level->frame_dims[1] };
+    hsize_t max_dims[3] = { H5S_UNLIMITED, level->frame_dims[0], level->frame_dims[1] };
+    hsize_t chunk_dims[3];
+
+    chunk_dims[0] = priv->chunk_frames;
+    chunk_dims[1] = priv->chunk_height > 0 ? MIN (priv->chunk_height, level->frame_dims[0]) : level->frame_dims[0];
+    chunk_dims[2] = priv->chunk_width > 0 ? MIN (priv->chunk_width, level->frame_dims[1]) : level->frame_dims[1];
+
+    group_id = make_groups (priv->file_id, level->name);
+    dataspace_id = H5Screate_simple (3, dims, max_dims);
+    dcpl = H5Pcreate (H5P_DATASET_CREATE);
+    H5Pset_chunk (dcpl, 3, chunk_dims);
+
+    /* Shuffling bytes only pays off when followed by compression */
+    if (priv->shuffle)
+        H5Pset_shuffle (dcpl);
+
+    if (priv->deflate > 0) {
+        if (H5Zfilter_avail (H5Z_FILTER_DEFLATE))
+            H5Pset_deflate (dcpl, priv->deflate);
+        else
+            g_warning ("hdf5: deflate filter not available, writing uncompressed");
+    }
+
+    level->dataset_id = H5Dcreate (group_id, level->name, priv->mem_type, dataspace_id,
+                                   H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+    if (group_id != priv->file_id)
+        H5Gclose (group_id);
+
+    H5Pclose (dcpl);
+    H5Sclose (dataspace_id);
+}
+
+static void
+open_levels (UfoHdf5WriterPrivate *priv, UfoWriterImage *image)
+{
+    gsize width = image->requisition->dims[0];
+    gsize height = image->requisition->dims[1];
+    guint n_levels;
+
+    priv->mem_type = buffer_depth_to_hdf5_type (image->depth);
+
+    /* Quantized samples cannot be averaged into levels */
+    n_levels = image->quantized ? 0 : priv->n_levels;
+
+    /* Stop downsampling once a level would become empty */
+    for (priv->n_active = 0; priv->n_active <= n_levels && width > 0 && height > 0; priv->n_active++) {
+        Level *level = &priv->levels[priv->n_active];
+
+        g_free (level->name);
+        level->name = priv->n_active == 0 ? g_strdup (priv->dataset) :
+                                            g_strdup_printf ("%s-%ux", priv->dataset, 1 << priv->n_active);
+        level->frame_dims[0] = height;
+        level->frame_dims[1] = width;
+        level->frame_size = width * height * bytes_per_sample (image->depth);
+        level->requisition.n_dims = 2;
+        level->requisition.dims[0] = width;
+        level->requisition.dims[1] = height;
+
+        if (dataset_exists (priv->file_id, level->name))
+            level->dataset_id = H5Dopen (priv->file_id, level->name, H5P_DEFAULT);
+        else
+            create_dataset (priv, level);
+
+        g_free (level->frames);
+        level->frames = priv->chunk_frames > 1 ? g_malloc (priv->chunk_frames * level->frame_size) : NULL;
+
+        if (priv->n_active > 0) {
+            g_free (level->pixels);
+            level->pixels = g_malloc (width * height * sizeof (gfloat));
+        }
+
+        width /= 2;
+        height /= 2;
+    }
+}
+
+static void
+write_frames (UfoHdf5WriterPrivate *priv,
+              Level *level,
+              gpointer data,
+              guint n_frames)
 {
-    UfoHdf5WriterPrivate *priv;
     hid_t dst_dataspace_id;
     hid_t src_dataspace_id;
-    hid_t mem_type;
+
+    hsize_t offset[3] = { priv->current, 0, 0 };
+    hsize_t count[3] = { n_frames, level->frame_dims[0], level->frame_dims[1] };
+    hsize_t dims[3] = { priv->current + n_frames, level->frame_dims[0], level->frame_dims[1] };
+
+    H5Dset_extent (level->dataset_id, dims);
+
+    dst_dataspace_id = H5Dget_space (level->dataset_id);
+    src_dataspace_id = H5Screate_simple (3, count, NULL);
+
+    H5Sselect_hyperslab (dst_dataspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+    H5Dwrite (level->dataset_id, priv->mem_type, src_dataspace_id, dst_dataspace_id, H5P_DEFAULT, data);
+
+    H5Sclose (src_dataspace_id);
+    H5Sclose (dst_dataspace_id);
+}
+
+static void
+ufo_hdf5_writer_write (UfoWriter *writer,
+                       UfoWriterImage *image)
+{
+    UfoHdf5WriterPrivate *priv;
 
     priv = UFO_HDF5_WRITER_GET_PRIVATE (writer);
 
-    hsize_t offset[3] = { priv->current, 0, 0 };
-    hsize_t count[3] = { 1, requisition->dims[1], requisition->dims[0] };
-    hsize_t dims[3] = { priv->current + 1, requisition->dims[1], requisition->dims[0] };
-    hsize_t src_dims[2] = { requisition->dims[0], requisition->dims[1] };
-    mem_type = buffer_depth_to_hdf5_type (depth);
-
-    if (priv->current == 0) {
-        if (dataset_exists (priv->file_id, priv->dataset)) {
-            priv->dataset_id = H5Dopen (priv->file_id, priv->dataset, H5P_DEFAULT);
-        }
-        else {
-            hid_t group_id;
-            hid_t dcpl;
-            hsize_t max_dims[3] = { H5S_UNLIMITED, requisition->dims[1], requisition->dims[0] };
+    if (priv->n_active == 0)
+        open_levels (priv, image);
+
+    /* Each level is computed from the previous one before it is converted */
+    for (guint i = 1; i < priv->n_active; i++) {
+        Level *prev = &priv->levels[i - 1];
 
-            group_id = make_groups (priv->file_id, priv->dataset);
+        ufo_writer_downsample (i == 1 ? image->data : prev->pixels,
+                               prev->requisition.dims[0], prev->requisition.dims[1],
+                               priv->levels[i].pixels);
+    }
 
-            dst_dataspace_id = H5Screate_simple (3, dims, max_dims);
-            dcpl = H5Pcreate (H5P_DATASET_CREATE);
-            H5Pset_chunk (dcpl, 3, dims);
-            priv->dataset_id = H5Dcreate (group_id, priv->dataset, mem_type, dst_dataspace_id,
-                                          H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    for (guint i = 0; i < priv->n_active; i++) {
+        Level *level = &priv->levels[i];
+        UfoWriterImage level_image = *image;
 
-            H5Pclose (dcpl);
-            H5Sclose (dst_dataspace_id);
+        if (i > 0) {
+            level_image.data = level->pixels;
+            level_image.requisition = &level->requisition;
         }
+
+        ufo_writer_convert_inplace (&level_image);
+
+        if (priv->chunk_frames == 1)
+            write_frames (priv, level, level_image.data, 1);
+        else
+            memcpy (level->frames + priv->n_buffered * level->frame_size, level_image.data, level->frame_size);
     }
-    else {
-        H5Dset_extent (priv->dataset_id, dims);
+
+    if (priv->chunk_frames == 1) {
+        priv->current++;
+        return;
     }
 
-    ufo_writer_convert_inplace (data, requisition, depth);
+    if (++priv->n_buffered == priv->chunk_frames) {
+        for (guint i = 0; i < priv->n_active; i++)
+            write_frames (priv, &priv->levels[i], priv->levels[i].frames, priv->n_buffered);
 
-    dst_dataspace_id = H5Dget_space (priv->dataset_id);
-    src_dataspace_id = H5Screate_simple (2, src_dims, NULL);
+        priv->current += priv->n_buffered;
+        priv->n_buffered = 0;
+    }
+}
 
-    H5Sselect_hyperslab (dst_dataspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
-    H5Dwrite (priv->dataset_id, mem_type, src_dataspace_id, dst_dataspace_id, H5P_DEFAULT, data);
+static void
+ufo_hdf5_writer_write_many (UfoWriter *writer,
+                            UfoWriterImage *image,
+                            guint n_frames,
+                            gsize stride)
+{
+    UfoHdf5WriterPrivate *priv;
 
-    H5Sclose (src_dataspace_id);
-    H5Sclose (dst_dataspace_id);
-    priv->current++;
+    priv = UFO_HDF5_WRITER_GET_PRIVATE (writer);
+
+    if (priv->n_active == 0)
+        open_levels (priv, image);
+
+    /* Levels and partially collected chunks need the per-frame path */
+    if (priv->n_active > 1 || priv->n_buffered > 0) {
+        for (guint i = 0; i < n_frames; i++) {
+            UfoWriterImage frame = *image;
+
+            frame.data = ((guint8 *) image->data) + i * stride;
+            ufo_hdf5_writer_write (writer, &frame);
+        }
+
+        return;
+    }
+
+    ufo_writer_convert_many (image, n_frames, stride);
+    write_frames (priv, &priv->levels[0], image->data, n_frames);
+    priv->current += n_frames;
+}
+
+static void
+ufo_hdf5_writer_close (UfoWriter *writer)
+{
+    UfoHdf5WriterPrivate *priv;
+
+    priv = UFO_HDF5_WRITER_GET_PRIVATE (writer);
+
+    for (guint i = 0; i < priv->n_active; i++) {
+        /* Last, possibly incomplete row of chunks */
+        if (priv->n_buffered > 0)
+            write_frames (priv, &priv->levels[i], priv->levels[i].frames, priv->n_buffered);
+
+        H5Dclose (priv->levels[i].dataset_id);
+    }
+
+    H5Fclose (priv->file_id);
+    priv->file_id = -1;
+    priv->n_active = 0;
+    priv->n_buffered = 0;
 }
 
 static void
@@ -233,8 +490,18 @@ ufo_hdf5_writer_finalize (GObject *object)
     UfoHdf5WriterPrivate *priv;
 
     priv = UFO_HDF5_WRITER_GET_PRIVATE (object);
+
+    if (priv->file_id >= 0)
+        ufo_hdf5_writer_close (UFO_WRITER (object));
+
     g_free (priv->dataset);
 
+    for (guint i = 0; i <= MAX_LEVELS; i++) {
+        g_free (priv->levels[i].name);
+        g_free (priv->levels[i].frames);
+        g_free (priv->levels[i].pixels);
+    }
+
     G_OBJECT_CLASS (ufo_hdf5_writer_parent_class)->finalize (object);
 }
 
@@ -245,6 +512,7 @@ ufo_writer_interface_init (UfoWriterIface *iface)
     iface->open = ufo_hdf5_writer_open;
     iface->close = ufo_hdf5_writer_close;
     iface->write = ufo_hdf5_writer_write;
+    iface->write_many = ufo_hdf5_writer_write_many;
 }
 
 static void
@@ -264,4 +532,19 @@ ufo_hdf5_writer_init (UfoHdf5Writer *self)
 
     self->priv = priv = UFO_HDF5_WRITER_GET_PRIVATE (self);
     priv->dataset = NULL;
+    priv->file_id = -1;
+    priv->n_levels = 0;
+    priv->n_active = 0;
+    priv->chunk_frames = 1;
+    priv->chunk_height = 0;
+    priv->chunk_width = 0;
+    priv->shuffle = FALSE;
+    priv->deflate = 0;
+    priv->n_buffered = 0;
+
+    for (guint i = 0; i <= MAX_LEVELS; i++) {
+        priv->levels[i].name = NULL;
+        priv->levels[i].frames = NULL;
+        priv->levels[i].pixels = NULL;
+    }
 }
@@ -46,8 +46,18 @@ struct _UfoHdf5WriterClass {
     GObjectClass parent_class;
 };
 
-UfoHdf5Writer  *ufo_hdf5_writer_new       (void);
-GType           ufo_hdf5_writer_get_type  (void);
+UfoHdf5Writer  *ufo_hdf5_writer_new         (void);
+void            ufo_hdf5_writer_set_chunks  (UfoHdf5Writer *writer,
+                                             guint          frames,
+                                             guint          height,
+                                             guint          width);
+void            ufo_hdf5_writer_set_shuffle (UfoHdf5Writer *writer,
+                                             gboolean       shuffle);
+void            ufo_hdf5_writer_set_deflate (UfoHdf5Writer *writer,
+                                             guint          level);
+void            ufo_hdf5_writer_set_levels  (UfoHdf5Writer *writer,
+                                             guint          n_levels);
+GType           ufo_hdf5_writer_get_type    (void);
 
 G_END_DECLS
 
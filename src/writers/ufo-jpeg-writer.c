@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <jpeglib.h>
 #include <jerror.h>
 
@@ -25,11 +27,34 @@
 #include "writers/ufo-jpeg-writer.h"
 
 
-struct _UfoJpegWriterPrivate {
+/*
+ * Compression state of one encoding thread. libjpeg objects must not be shared
+ * between threads, so each pool thread takes its own encoder.
+ */
+typedef struct {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr error;
+    guint8 *row;
+    gsize row_size;
+} Encoder;
+
+typedef struct {
+    gchar *filename;
+    gpointer data;
+    gsize size;
+    UfoRequisition requisition;
+    UfoWriterImage image;
+} EncodeJob;
+
+struct _UfoJpegWriterPrivate {
+    Encoder encoder;
     FILE *fp;
+    gchar *filename;
     int quality;
+    guint n_threads;
+    GThreadPool *pool;
+    GAsyncQueue *encoders;
+    GAsyncQueue *free_jobs;
 };
 
 static void ufo_writer_interface_init (UfoWriterIface *iface);
@@ -53,6 +78,198 @@ ufo_jpeg_writer_set_quality (UfoJpegWriter *writer, gint quality)
     writer->priv->quality = quality;
 }
 
+static void
+encoder_init (Encoder *encoder)
+{
+    encoder->cinfo.err = jpeg_std_error (&encoder->error);
+    jpeg_create_compress (&encoder->cinfo);
+    encoder->row = NULL;
+    encoder->row_size = 0;
+}
+
+static void
+encoder_free (Encoder *encoder)
+{
+    jpeg_destroy_compress (&encoder->cinfo);
+    g_free (encoder->row);
+}
+
+static gsize
+get_frame_size (UfoWriterImage *image)
+{
+    gsize n_pixels = image->requisition->dims[0] * image->requisition->dims[1];
+
+    if (!image->quantized)
+        return n_pixels * sizeof (gfloat);
+
+    return image->depth == UFO_BUFFER_DEPTH_8U ? n_pixels : n_pixels * sizeof (guint16);
+}
+
+/*
+ * Each row is converted to 8 bits right before it is handed to libjpeg, which
+ * keeps the converted row in cache and leaves the float frame untouched.
+ * Quantized 16-bit rows keep their upper byte.
+ */
+static void
+encode (Encoder *encoder,
+        FILE *fp,
+        UfoWriterImage *image,
+        gint quality)
+{
+    struct jpeg_compress_struct *cinfo = &encoder->cinfo;
+    gsize width = image->requisition->dims[0];
+    gfloat min = image->min;
+    gfloat max = image->max;
+
+    /* Same mapping as ufo_writer_convert_inplace */
+    if (!image->quantized && !(min < max)) {
+        ufo_writer_get_min_max (image->data, image->requisition, &min, &max);
+
+        if (min >= 0.0f && max <= 255.0f) {
+            min = 0.0f;
+            max = 255.0f;
+        }
+    }
+
+    if (encoder->row_size < width) {
+        g_free (encoder->row);
+        encoder->row = g_malloc (width);
+        encoder->row_size = width;
+    }
+
+    cinfo->image_width = width;
+    cinfo->image_height = image->requisition->dims[1];
+    cinfo->input_components = 1;
+    cinfo->in_color_space = JCS_GRAYSCALE;
+
+    jpeg_stdio_dest (cinfo, fp);
+    jpeg_set_defaults (cinfo);
+    jpeg_set_quality (cinfo, quality, 1);
+    jpeg_start_compress (cinfo, TRUE);
+
+    while (cinfo->next_scanline < cinfo->image_height) {
+        JSAMPROW row_pointer[1];
+        gsize offset = cinfo->next_scanline * width;
+
+        row_pointer[0] = (JSAMPROW) encoder->row;
+
+        if (!image->quantized) {
+            ufo_writer_quantize_row (((gfloat *) image->data) + offset, encoder->row, width, min, max);
+        }
+        else if (image->depth == UFO_BUFFER_DEPTH_8U) {
+            row_pointer[0] = (JSAMPROW) (((guint8 *) image->data) + offset);
+        }
+        else {
+            const guint16 *src = ((const guint16 *) image->data) + offset;
+
+            for (gsize i = 0; i < width; i++)
+                encoder->row[i] = (guint8) (src[i] >> 8);
+        }
+
+        jpeg_write_scanlines (cinfo, row_pointer, 1);
+    }
+
+    jpeg_finish_compress (cinfo);
+}
+
+static void
+encode_job (EncodeJob *job, UfoJpegWriterPrivate *priv)
+{
+    Encoder *encoder;
+    FILE *fp;
+
+    fp = fopen (job->filename, "wb");
+
+    if (fp == NULL) {
+        g_warning ("jpeg: cannot open `%s': %s", job->filename, g_strerror (errno));
+    }
+    else {
+        /* There are as many encoders as pool threads, so this never blocks */
+        encoder = (Encoder *) g_async_queue_pop (priv->encoders);
+        encode (encoder, fp, &job->image, priv->quality);
+        g_async_queue_push (priv->encoders, encoder);
+        fclose (fp);
+    }
+
+    g_free (job->filename);
+    job->filename = NULL;
+    g_async_queue_push (priv->free_jobs, job);
+}
+
+static void
+stop_pool (UfoJpegWriterPrivate *priv)
+{
+    Encoder *encoder;
+    EncodeJob *job;
+
+    if (priv->pool == NULL)
+        return;
+
+    /* Finishes all queued frames before returning */
+    g_thread_pool_free (priv->pool, FALSE, TRUE);
+    priv->pool = NULL;
+
+    while ((encoder = (Encoder *) g_async_queue_try_pop (priv->encoders)) != NULL) {
+        encoder_free (encoder);
+        g_free (encoder);
+    }
+
+    while ((job = (EncodeJob *) g_async_queue_try_pop (priv->free_jobs)) != NULL) {
+        g_free (job->data);
+        g_free (job);
+    }
+
+    g_async_queue_unref (priv->encoders);
+    g_async_queue_unref (priv->free_jobs);
+}
+
+/**
+ * ufo_jpeg_writer_set_num_threads:
+ * @writer: A #UfoJpegWriter
+ * @n_threads: Number of encoding threads
+ *
+ * With more than one thread, written frames are copied and encoded in the
+ * background. Each frame must be opened as its own file, files may be
+ * completed out of order. At most two frames per thread are queued, further
+ * writes block.
+ */
+void
+ufo_jpeg_writer_set_num_threads (UfoJpegWriter *writer, guint n_threads)
+{
+    UfoJpegWriterPrivate *priv = writer->priv;
+    GError *error = NULL;
+
+    if (n_threads == priv->n_threads)
+        return;
+
+    stop_pool (priv);
+    priv->n_threads = n_threads;
+
+    if (n_threads < 2)
+        return;
+
+    priv->encoders = g_async_queue_new ();
+    priv->free_jobs = g_async_queue_new ();
+
+    for (guint i = 0; i < n_threads; i++) {
+        Encoder *encoder = g_new0 (Encoder, 1);
+
+        encoder_init (encoder);
+        g_async_queue_push (priv->encoders, encoder);
+    }
+
+    for (guint i = 0; i < 2 * n_threads; i++)
+        g_async_queue_push (priv->free_jobs, g_new0 (EncodeJob, 1));
+
+    priv->pool = g_thread_pool_new ((GFunc) encode_job, priv, (gint) n_threads, TRUE, &error);
+
+    if (error != NULL) {
+        g_warning ("jpeg: cannot start encoding threads: %s", error->message);
+        g_error_free (error);
+        priv->pool = NULL;
+    }
+}
+
 static gboolean
 ufo_jpeg_writer_can_open (UfoWriter *writer,
                           const gchar *filename)
@@ -67,6 +284,13 @@ ufo_jpeg_writer_open (UfoWriter *writer,
     UfoJpegWriterPrivate *priv;
     
     priv = UFO_JPEG_WRITER_GET_PRIVATE (writer);
+
+    /* Encoding threads open the file once the frame is written */
+    if (priv->pool != NULL) {
+        priv->filename = g_strdup (filename);
+        return;
+    }
+
     priv->fp = fopen (filename, "wb");
 }
 
@@ -76,6 +300,13 @@ ufo_jpeg_writer_close (UfoWriter *writer)
     UfoJpegWriterPrivate *priv;
     
     priv = UFO_JPEG_WRITER_GET_PRIVATE (writer);
+
+    if (priv->pool != NULL) {
+        g_free (priv->filename);
+        priv->filename = NULL;
+        return;
+    }
+
     g_assert (priv->fp != NULL);
     fclose (priv->fp);
     priv->fp = NULL;
@@ -83,38 +314,39 @@ ufo_jpeg_writer_close (UfoWriter *writer)
 
 static void
 ufo_jpeg_writer_write (UfoWriter *writer,
-                       gpointer data,
-                       UfoRequisition *requisition,
-                       UfoBufferDepth depth)
+                       UfoWriterImage *image)
 {
     UfoJpegWriterPrivate *priv;
-    gint row_stride;
+    EncodeJob *job;
+    gsize size;
 
     priv = UFO_JPEG_WRITER_GET_PRIVATE (writer);
 
-    priv->cinfo.image_width = requisition->dims[0];
-    priv->cinfo.image_height = requisition->dims[1];
-    priv->cinfo.input_components = 1;
-    priv->cinfo.in_color_space = JCS_GRAYSCALE;
-
-    jpeg_stdio_dest (&priv->cinfo, priv->fp);
-    jpeg_set_defaults (&priv->cinfo);
-    jpeg_set_quality (&priv->cinfo, priv->quality, 1);
-    jpeg_start_compress (&priv->cinfo, TRUE);
-
     /* We have to ignore the given bit depth for JPEG */
-    ufo_writer_convert_inplace (data, requisition, UFO_BUFFER_DEPTH_8U);
+    if (priv->pool == NULL) {
+        encode (&priv->encoder, priv->fp, image, priv->quality);
+        return;
+    }
 
-    row_stride = (gint) requisition->dims[0];
+    g_assert (priv->filename != NULL);
+    size = get_frame_size (image);
 
-    while (priv->cinfo.next_scanline < priv->cinfo.image_height) {
-        JSAMPROW row_pointer[1];
-        row_pointer[0] = (JSAMPROW) (((gchar *) data) + priv->cinfo.next_scanline * row_stride);
-        jpeg_write_scanlines (&priv->cinfo, row_pointer, 1);
+    /* Blocks until an encoding thread returns a job if all are queued */
+    job = (EncodeJob *) g_async_queue_pop (priv->free_jobs);
+
+    if (job->size < size) {
+        g_free (job->data);
+        job->data = g_malloc (size);
+        job->size = size;
     }
 
-    jpeg_finish_compress (&priv->cinfo);
-    jpeg_abort_compress (&priv->cinfo);
+    memcpy (job->data, image->data, size);
+    job->filename = g_strdup (priv->filename);
+    job->requisition = *image->requisition;
+    job->image = *image;
+    job->image.data = job->data;
+    job->image.requisition = &job->requisition;
+    g_thread_pool_push (priv->pool, job, NULL);
 }
 
 static void
@@ -124,7 +356,9 @@ ufo_jpeg_writer_finalize (GObject *object)
     
     priv = UFO_JPEG_WRITER_GET_PRIVATE (object);
 
-    jpeg_destroy_compress (&priv->cinfo);
+    stop_pool (priv);
+    encoder_free (&priv->encoder);
+    g_free (priv->filename);
 
     if (priv->fp != NULL)
         ufo_jpeg_writer_close (UFO_WRITER (object));
@@ -158,7 +392,9 @@ ufo_jpeg_writer_init (UfoJpegWriter *self)
 
     self->priv = priv = UFO_JPEG_WRITER_GET_PRIVATE (self);
     priv->fp = NULL;
+    priv->filename = NULL;
     priv->quality = 95;
-    priv->cinfo.err = jpeg_std_error (&priv->error);
-    jpeg_create_compress (&priv->cinfo);
+    priv->n_threads = 1;
+    priv->pool = NULL;
+    encoder_init (&priv->encoder);
 }
@@ -48,6 +48,8 @@ struct _UfoJpegWriterClass {
 
 UfoJpegWriter  *ufo_jpeg_writer_new         (void);
 void            ufo_jpeg_writer_set_quality (UfoJpegWriter *writer, gint quality);
+void            ufo_jpeg_writer_set_num_threads
+                                            (UfoJpegWriter *writer, guint n_threads);
 GType           ufo_jpeg_writer_get_type    (void);
 
 G_END_DECLS
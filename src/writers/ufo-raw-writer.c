@@ -17,14 +17,41 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
+/* O_DIRECT, pwrite and posix_fallocate are not part of C99 */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "writers/ufo-writer.h"
 #include "writers/ufo-raw-writer.h"
 
+/* Alignment of buffers, offsets and sizes required by O_DIRECT */
+#define ALIGNMENT 4096
+
 
 struct _UfoRawWriterPrivate {
-    FILE *fp;
+    gint fd;
+    gint direct_fd;
+
+    guint num_frames;
+    gsize buffer_size;
+    gboolean direct;
+
+    /* Frames are coalesced here and written in large, aligned blocks */
+    gchar *staging;
+    gsize staging_size;
+    gsize capacity;
+    gsize staged;
+    goffset offset;
+
+    /* Shared with write_at, which may be called from several threads */
+    GMutex lock;
+    gboolean allocated;
+    goffset end;
 };
 
 static void ufo_writer_interface_init (UfoWriterIface *iface);
@@ -42,6 +69,27 @@ ufo_raw_writer_new (void)
     return writer;
 }
 
+void
+ufo_raw_writer_set_num_frames (UfoRawWriter *writer,
+                               guint num_frames)
+{
+    writer->priv->num_frames = num_frames;
+}
+
+void
+ufo_raw_writer_set_buffer_size (UfoRawWriter *writer,
+                                gsize buffer_size)
+{
+    writer->priv->buffer_size = buffer_size;
+}
+
+void
+ufo_raw_writer_set_direct (UfoRawWriter *writer,
+                           gboolean direct)
+{
+    writer->priv->direct = direct;
+}
+
 static gboolean
 ufo_raw_writer_can_open (UfoWriter *writer,
                          const gchar *filename)
@@ -54,20 +102,131 @@ ufo_raw_writer_open (UfoWriter *writer,
                      const gchar *filename)
 {
     UfoRawWriterPrivate *priv;
-    
+
     priv = UFO_RAW_WRITER_GET_PRIVATE (writer);
-    priv->fp = fopen (filename, "wb");
+    priv->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (priv->fd < 0) {
+        g_warning ("raw: cannot open `%s': %s", filename, g_strerror (errno));
+        return;
+    }
+
+    priv->direct_fd = -1;
+    priv->staged = 0;
+    priv->offset = 0;
+    priv->end = 0;
+    priv->allocated = FALSE;
+
+#ifdef O_DIRECT
+    if (priv->direct) {
+        priv->direct_fd = open (filename, O_WRONLY | O_DIRECT);
+
+        if (priv->direct_fd < 0)
+            g_warning ("raw: cannot use direct I/O for `%s': %s", filename, g_strerror (errno));
+    }
+#endif
+
+    /* Direct I/O always needs an aligned staging buffer */
+    priv->capacity = (MAX (priv->buffer_size, priv->direct_fd >= 0 ? ALIGNMENT : 0) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    /* A later file may use a larger buffer than the one we already have */
+    if (priv->capacity > priv->staging_size) {
+        gpointer staging;
+
+        free (priv->staging);
+        priv->staging = NULL;
+        priv->staging_size = 0;
+
+        if (posix_memalign (&staging, ALIGNMENT, priv->capacity)) {
+            g_warning ("raw: cannot allocate staging buffer");
+            priv->capacity = 0;
+        }
+        else {
+            priv->staging = staging;
+            priv->staging_size = priv->capacity;
+        }
+    }
+}
+
+static void
+write_all (gint fd, const gchar *data, gsize size, goffset offset)
+{
+    while (size > 0) {
+        ssize_t written = pwrite (fd, data, size, offset);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_warning ("raw: cannot write: %s", g_strerror (errno));
+            return;
+        }
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+static void
+flush_staging (UfoRawWriterPrivate *priv, gboolean final)
+{
+    gsize aligned = 0;
+
+    if (priv->staged == 0)
+        return;
+
+    /* Only whole blocks go through O_DIRECT, the tail of the file does not */
+    if (priv->direct_fd >= 0) {
+        aligned = final ? priv->staged / ALIGNMENT * ALIGNMENT : priv->staged;
+        write_all (priv->direct_fd, priv->staging, aligned, priv->offset);
+    }
+
+    write_all (priv->fd, priv->staging + aligned, priv->staged - aligned, priv->offset + aligned);
+
+    priv->offset += priv->staged;
+    priv->staged = 0;
+}
+
+static void
+preallocate (UfoRawWriterPrivate *priv, gsize frame_size, goffset end)
+{
+    g_mutex_lock (&priv->lock);
+
+    if (!priv->allocated && priv->num_frames > 0) {
+        /* Reserve the whole volume at once to avoid fragmentation */
+        gint err = posix_fallocate (priv->fd, 0, (off_t) (frame_size * priv->num_frames));
+
+        if (err != 0)
+            g_warning ("raw: cannot preallocate %zu bytes: %s", frame_size * priv->num_frames, g_strerror (err));
+    }
+
+    priv->allocated = TRUE;
+    priv->end = MAX (priv->end, end);
+    g_mutex_unlock (&priv->lock);
 }
 
 static void
 ufo_raw_writer_close (UfoWriter *writer)
 {
     UfoRawWriterPrivate *priv;
-    
+
     priv = UFO_RAW_WRITER_GET_PRIVATE (writer);
-    g_assert (priv->fp != NULL);
-    fclose (priv->fp);
-    priv->fp = NULL;
+    g_assert (priv->fd >= 0);
+
+    flush_staging (priv, TRUE);
+
+    /* Drop preallocated space if fewer frames than expected were written */
+    if (priv->num_frames > 0 && ftruncate (priv->fd, (off_t) MAX (priv->end, priv->offset)))
+        g_warning ("raw: cannot truncate: %s", g_strerror (errno));
+
+    if (priv->direct_fd >= 0) {
+        close (priv->direct_fd);
+        priv->direct_fd = -1;
+    }
+
+    close (priv->fd);
+    priv->fd = -1;
 }
 
 static gsize
@@ -84,35 +243,122 @@ bytes_per_pixel (UfoBufferDepth depth)
     }
 }
 
+static gsize
+get_frame_size (UfoRequisition *requisition, UfoBufferDepth depth)
+{
+    gsize size = bytes_per_pixel (depth);
+
+    for (guint i = 0; i < requisition->n_dims; i++)
+        size *= requisition->dims[i];
+
+    return size;
+}
+
+static void
+append (UfoRawWriterPrivate *priv,
+        const gchar *src,
+        gsize frame_size,
+        guint n_frames)
+{
+    gsize size = frame_size * n_frames;
+
+    preallocate (priv, frame_size, priv->offset + priv->staged + size);
+
+    if (priv->capacity == 0) {
+        write_all (priv->fd, src, size, priv->offset);
+        priv->offset += size;
+        return;
+    }
+
+    while (size > 0) {
+        gsize n_bytes = MIN (size, priv->capacity - priv->staged);
+
+        memcpy (priv->staging + priv->staged, src, n_bytes);
+        priv->staged += n_bytes;
+        src += n_bytes;
+        size -= n_bytes;
+
+        if (priv->staged == priv->capacity)
+            flush_staging (priv, FALSE);
+    }
+}
+
 static void
 ufo_raw_writer_write (UfoWriter *writer,
-                      gpointer data,
-                      UfoRequisition *requisition,
-                      UfoBufferDepth depth)
+                      UfoWriterImage *image)
 {
     UfoRawWriterPrivate *priv;
-    gsize size = bytes_per_pixel (depth);
 
     priv = UFO_RAW_WRITER_GET_PRIVATE (writer);
 
-    ufo_writer_convert_inplace (data, requisition, depth);
+    if (priv->fd < 0)
+        return;
 
-    for (guint i = 0; i < requisition->n_dims; i++)
-        size *= requisition->dims[i];
+    ufo_writer_convert_inplace (image);
+    append (priv, image->data, get_frame_size (image->requisition, image->depth), 1);
+}
+
+static void
+ufo_raw_writer_write_many (UfoWriter *writer,
+                           UfoWriterImage *image,
+                           guint n_frames,
+                           gsize stride)
+{
+    UfoRawWriterPrivate *priv;
+    gsize frame_size;
+
+    priv = UFO_RAW_WRITER_GET_PRIVATE (writer);
 
-    fwrite (data, 1, size, priv->fp);
+    if (priv->fd < 0)
+        return;
+
+    /* Packed frames go out with a single write */
+    frame_size = ufo_writer_convert_many (image, n_frames, stride);
+    append (priv, image->data, frame_size, n_frames);
+}
+
+/**
+ * ufo_raw_writer_write_at:
+ * @writer: A #UfoRawWriter
+ * @image: Frame to write
+ * @index: Position of the frame in the file
+ *
+ * Write a frame at the offset given by @index, independently of the frames
+ * written before. Several threads may call this concurrently on the same
+ * writer, however it must not be mixed with ufo_writer_write().
+ */
+void
+ufo_raw_writer_write_at (UfoRawWriter *writer,
+                         UfoWriterImage *image,
+                         guint index)
+{
+    UfoRawWriterPrivate *priv;
+    gsize size;
+
+    priv = writer->priv;
+
+    if (priv->fd < 0)
+        return;
+
+    ufo_writer_convert_inplace (image);
+    size = get_frame_size (image->requisition, image->depth);
+    preallocate (priv, size, (goffset) ((index + 1) * size));
+    write_all (priv->fd, image->data, size, (goffset) (index * size));
 }
 
 static void
 ufo_raw_writer_finalize (GObject *object)
 {
     UfoRawWriterPrivate *priv;
-    
+
     priv = UFO_RAW_WRITER_GET_PRIVATE (object);
 
-    if (priv->fp != NULL)
+    if (priv->fd >= 0)
         ufo_raw_writer_close (UFO_WRITER (object));
 
+    free (priv->staging);
+    g_mutex_clear (&priv->lock);
+
     G_OBJECT_CLASS (ufo_raw_writer_parent_class)->finalize (object);
 }
 
@@ -123,6 +369,7 @@ ufo_writer_interface_init (UfoWriterIface *iface)
     iface->open = ufo_raw_writer_open;
     iface->close = ufo_raw_writer_close;
     iface->write = ufo_raw_writer_write;
+    iface->write_many = ufo_raw_writer_write_many;
 }
 
 static void
@@ -141,5 +388,17 @@ ufo_raw_writer_init (UfoRawWriter *self)
     UfoRawWriterPrivate *priv = NULL;
 
     self->priv = priv = UFO_RAW_WRITER_GET_PRIVATE (self);
-    priv->fp = NULL;
+    priv->fd = -1;
+    priv->direct_fd = -1;
+    priv->num_frames = 0;
+    priv->buffer_size = 0;
+    priv->direct = FALSE;
+    priv->staging = NULL;
+    priv->staging_size = 0;
+    priv->capacity = 0;
+    priv->staged = 0;
+    priv->offset = 0;
+    priv->allocated = FALSE;
+    priv->end = 0;
+    g_mutex_init (&priv->lock);
 }
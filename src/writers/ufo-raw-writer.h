@@ -21,6 +21,7 @@
 #define UFO_RAW_WRITER_RAW_H
 
 #include <glib-object.h>
+#include <ufo/ufo.h>
 
 G_BEGIN_DECLS
 
@@ -46,8 +47,17 @@ struct _UfoRawWriterClass {
     GObjectClass parent_class;
 };
 
-UfoRawWriter  *ufo_raw_writer_new       (void);
-GType          ufo_raw_writer_get_type  (void);
+UfoRawWriter  *ufo_raw_writer_new              (void);
+void           ufo_raw_writer_set_num_frames   (UfoRawWriter   *writer,
+                                                guint           num_frames);
+void           ufo_raw_writer_set_buffer_size  (UfoRawWriter   *writer,
+                                                gsize           buffer_size);
+void           ufo_raw_writer_set_direct       (UfoRawWriter   *writer,
+                                                gboolean        direct);
+void           ufo_raw_writer_write_at         (UfoRawWriter   *writer,
+                                                UfoWriterImage *image,
+                                                guint           index);
+GType          ufo_raw_writer_get_type         (void);
 
 G_END_DECLS
 
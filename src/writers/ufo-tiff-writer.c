@@ -17,15 +17,46 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
+#include <string.h>
 #include <tiffio.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "writers/ufo-writer.h"
 #include "writers/ufo-tiff-writer.h"
 
+/* Uncompressed size of a strip, large enough to compress well */
+#define STRIP_SIZE (256 * 1024)
+
+#define MAX_LEVELS 6
+
+typedef struct {
+    gfloat *data;
+    UfoRequisition requisition;
+} Level;
+
 
 struct _UfoTiffWriterPrivate {
     TIFF *tiff;
     guint page;
+    gboolean bigtiff;
+    guint16 compression;
+
+    /* Downsampled levels, stored in consecutive parts of pixels */
+    guint n_levels;
+    Level levels[MAX_LEVELS];
+    gfloat *pixels;
+
+    /* Strips compressed ahead of handing them to libtiff */
+    guint8 *strips;
+    gsize *strip_sizes;
+    gsize strip_capacity;
+    gsize strip_bound;
+    guint n_strips;
 };
 
 static void ufo_writer_interface_init (UfoWriterIface *iface);
@@ -43,6 +74,74 @@ ufo_tiff_writer_new (void)
     return writer;
 }
 
+/**
+ * ufo_tiff_writer_set_bigtiff:
+ * @writer: A #UfoTiffWriter
+ * @bigtiff: %TRUE to write BigTIFF files
+ *
+ * BigTIFF files use 64 bit offsets and can grow beyond 4 GB. Takes effect
+ * when the next file is opened.
+ */
+void
+ufo_tiff_writer_set_bigtiff (UfoTiffWriter *writer,
+                             gboolean bigtiff)
+{
+    g_return_if_fail (UFO_IS_TIFF_WRITER (writer));
+    UFO_TIFF_WRITER_GET_PRIVATE (writer)->bigtiff = bigtiff;
+}
+
+/**
+ * ufo_tiff_writer_set_levels:
+ * @writer: A #UfoTiffWriter
+ * @n_levels: Number of downsampled levels
+ *
+ * Store @n_levels reduced images as sub directories of each page, each
+ * downsampled by two from the previous one.
+ */
+void
+ufo_tiff_writer_set_levels (UfoTiffWriter *writer,
+                            guint n_levels)
+{
+    g_return_if_fail (UFO_IS_TIFF_WRITER (writer));
+    UFO_TIFF_WRITER_GET_PRIVATE (writer)->n_levels = MIN (n_levels, MAX_LEVELS);
+}
+
+/**
+ * ufo_tiff_writer_set_compression:
+ * @writer: A #UfoTiffWriter
+ * @compression: One of "none", "deflate", "lzw" and "zstd"
+ *
+ * Returns: %FALSE if @compression is unknown or not supported by libtiff, in
+ * which case the previous compression is kept.
+ */
+gboolean
+ufo_tiff_writer_set_compression (UfoTiffWriter *writer,
+                                 const gchar *compression)
+{
+    guint16 scheme;
+
+    g_return_val_if_fail (UFO_IS_TIFF_WRITER (writer), FALSE);
+
+    if (!g_strcmp0 (compression, "none"))
+        scheme = COMPRESSION_NONE;
+    else if (!g_strcmp0 (compression, "deflate"))
+        scheme = COMPRESSION_ADOBE_DEFLATE;
+    else if (!g_strcmp0 (compression, "lzw"))
+        scheme = COMPRESSION_LZW;
+#ifdef COMPRESSION_ZSTD
+    else if (!g_strcmp0 (compression, "zstd"))
+        scheme = COMPRESSION_ZSTD;
+#endif
+    else
+        return FALSE;
+
+    if (!TIFFIsCODECConfigured (scheme))
+        return FALSE;
+
+    UFO_TIFF_WRITER_GET_PRIVATE (writer)->compression = scheme;
+    return TRUE;
+}
+
 static gboolean
 ufo_tiff_writer_can_open (UfoWriter *writer,
                           const gchar *filename)
@@ -57,7 +156,7 @@ ufo_tiff_writer_open (UfoWriter *writer,
     UfoTiffWriterPrivate *priv;
     
     priv = UFO_TIFF_WRITER_GET_PRIVATE (writer);
-    priv->tiff = TIFFOpen (filename, "w");
+    priv->tiff = TIFFOpen (filename, priv->bigtiff ? "w8" : "w");
     priv->page = 0;
 }
 
@@ -72,25 +171,207 @@ ufo_tiff_writer_close (UfoWriter *writer)
     priv->tiff = NULL;
 }
 
+static guint
+get_bits_per_sample (UfoBufferDepth depth)
+{
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            return 8;
+        case UFO_BUFFER_DEPTH_16U:
+        case UFO_BUFFER_DEPTH_16S:
+            return 16;
+        default:
+            return 32;
+    }
+}
+
+static guint32
+get_rows_per_strip (UfoWriterImage *image)
+{
+    gsize stride = image->requisition->dims[0] * get_bits_per_sample (image->depth) / 8;
+
+    return (guint32) MAX (1, MIN (STRIP_SIZE / stride, image->requisition->dims[1]));
+}
+
+static gsize
+set_fields (UfoTiffWriterPrivate *priv,
+            UfoWriterImage *image,
+            guint n_subifds)
+{
+    guint bits_per_sample;
+    guint32 rows_per_strip;
+    gsize stride;
+
+    bits_per_sample = get_bits_per_sample (image->depth);
+    stride = image->requisition->dims[0] * bits_per_sample / 8;
+    rows_per_strip = get_rows_per_strip (image);
+
+    TIFFSetField (priv->tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField (priv->tiff, TIFFTAG_IMAGEWIDTH, image->requisition->dims[0]);
+    TIFFSetField (priv->tiff, TIFFTAG_IMAGELENGTH, image->requisition->dims[1]);
+    TIFFSetField (priv->tiff, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+    TIFFSetField (priv->tiff, TIFFTAG_COMPRESSION, priv->compression);
+
+    if (n_subifds > 0) {
+        /* libtiff fills in the offsets of the directories written next */
+        guint64 offsets[MAX_LEVELS] = { 0, };
+
+        TIFFSetField (priv->tiff, TIFFTAG_SUBIFD, (guint16) n_subifds, offsets);
+    }
+
+    TIFFSetField (priv->tiff, TIFFTAG_SAMPLEFORMAT,
+                  bits_per_sample == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+    TIFFSetField (priv->tiff, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
+
+    return rows_per_strip * stride;
+}
+
+#ifdef HAVE_ZLIB
+static void
+compress_strips (UfoTiffWriterPrivate *priv,
+                 const guint8 *data,
+                 guint n_frames,
+                 gsize frame_size,
+                 gsize strip_size)
+{
+    guint strips_per_frame;
+
+    strips_per_frame = (guint) ((frame_size + strip_size - 1) / strip_size);
+    priv->strip_bound = compressBound (strip_size);
+    priv->n_strips = n_frames * strips_per_frame;
+
+    if (priv->strip_capacity < priv->n_strips * priv->strip_bound) {
+        g_free (priv->strips);
+        priv->strip_capacity = priv->n_strips * priv->strip_bound;
+        priv->strips = g_malloc (priv->strip_capacity);
+    }
+
+    priv->strip_sizes = g_renew (gsize, priv->strip_sizes, priv->n_strips);
+
+    /* Strips of all frames are compressed together to keep all threads busy */
+#pragma omp parallel for schedule(dynamic)
+    for (guint i = 0; i < priv->n_strips; i++) {
+        uLongf compressed_size = priv->strip_bound;
+        gsize offset = (i % strips_per_frame) * strip_size;
+        const guint8 *src = data + (i / strips_per_frame) * frame_size + offset;
+
+        if (compress2 (priv->strips + i * priv->strip_bound, &compressed_size, src,
+                       MIN (strip_size, frame_size - offset), Z_DEFAULT_COMPRESSION) != Z_OK)
+            compressed_size = 0;
+
+        priv->strip_sizes[i] = compressed_size;
+    }
+}
+
+static void
+write_raw_strips (UfoTiffWriterPrivate *priv,
+                  guint first,
+                  guint n_strips)
+{
+    for (guint i = 0; i < n_strips; i++) {
+        guint8 *strip = priv->strips + (first + i) * priv->strip_bound;
+        gsize size = priv->strip_sizes[first + i];
+
+        if (size == 0 || TIFFWriteRawStrip (priv->tiff, i, strip, (tmsize_t) size) == -1)
+            g_warning ("tiff: cannot write strip %u", i);
+    }
+}
+#endif
+
+static void
+write_directory (UfoTiffWriterPrivate *priv,
+                 UfoWriterImage *image,
+                 guint n_subifds)
+{
+    gsize strip_size;
+    gsize size;
+    guint8 *buff;
+
+    strip_size = set_fields (priv, image, n_subifds);
+    size = image->requisition->dims[0] * image->requisition->dims[1] * get_bits_per_sample (image->depth) / 8;
+    ufo_writer_convert_inplace (image);
+    buff = (guint8 *) image->data;
+
+#ifdef HAVE_ZLIB
+    /*
+     * libtiff compresses one strip after the other, so deflate strips are
+     * compressed in parallel beforehand and only stored by libtiff.
+     */
+    if (priv->compression == COMPRESSION_ADOBE_DEFLATE) {
+        compress_strips (priv, buff, 1, size, strip_size);
+        write_raw_strips (priv, 0, priv->n_strips);
+        TIFFWriteDirectory (priv->tiff);
+        return;
+    }
+#endif
+
+    for (guint i = 0; i * strip_size < size; i++) {
+        gsize offset = i * strip_size;
+
+        if (TIFFWriteEncodedStrip (priv->tiff, i, buff + offset, (tmsize_t) MIN (strip_size, size - offset)) == -1)
+            g_warning ("tiff: cannot write strip %u", i);
+    }
+
+    TIFFWriteDirectory (priv->tiff);
+}
+
+static guint
+downsample_levels (UfoTiffWriterPrivate *priv,
+                   UfoWriterImage *image)
+{
+    gsize width = image->requisition->dims[0];
+    gsize height = image->requisition->dims[1];
+    gsize size = 0;
+    guint n_levels;
+
+    /* Quantized samples cannot be averaged into levels */
+    if (image->quantized)
+        return 0;
+
+    /* Stop downsampling once a level would become empty */
+    for (n_levels = 0; n_levels < priv->n_levels && width >= 2 && height >= 2; n_levels++) {
+        width /= 2;
+        height /= 2;
+        size += width * height;
+    }
+
+    if (n_levels == 0)
+        return 0;
+
+    priv->pixels = g_renew (gfloat, priv->pixels, size);
+    width = image->requisition->dims[0];
+    height = image->requisition->dims[1];
+
+    for (guint i = 0; i < n_levels; i++) {
+        const gfloat *src = i == 0 ? image->data : priv->levels[i - 1].data;
+
+        priv->levels[i].requisition.n_dims = 2;
+        priv->levels[i].requisition.dims[0] = width / 2;
+        priv->levels[i].requisition.dims[1] = height / 2;
+        priv->levels[i].data = i == 0 ? priv->pixels : priv->levels[i - 1].data + (width * height);
+
+        ufo_writer_downsample (src, width, height, priv->levels[i].data);
+        width /= 2;
+        height /= 2;
+    }
+
+    return n_levels;
+}
+
 static void
 ufo_tiff_writer_write (UfoWriter *writer,
-                       gpointer data,
-                       UfoRequisition *requisition,
-                       UfoBufferDepth depth)
+                       UfoWriterImage *image)
 {
     UfoTiffWriterPrivate *priv;
-    guint bits_per_sample;
-    gsize stride;
-    gchar *buff;
+    guint n_levels;
 
     priv = UFO_TIFF_WRITER_GET_PRIVATE (writer);
     g_assert (priv->tiff != NULL);
 
+    /* Levels are computed from the float data before it is converted */
+    n_levels = downsample_levels (priv, image);
+
     TIFFSetField (priv->tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-    TIFFSetField (priv->tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    TIFFSetField (priv->tiff, TIFFTAG_IMAGEWIDTH, requisition->dims[0]);
-    TIFFSetField (priv->tiff, TIFFTAG_IMAGELENGTH, requisition->dims[1]);
-    TIFFSetField (priv->tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize (priv->tiff, (guint32) - 1));
 
     /*
      * I seriously don't know if this is supposed to be supported by the format,
@@ -99,35 +380,68 @@ ufo_tiff_writer_write (UfoWriter *writer,
      */
     TIFFSetField (priv->tiff, TIFFTAG_PAGENUMBER, priv->page, priv->page);
 
-    switch (depth) {
-        case UFO_BUFFER_DEPTH_8U:
-            TIFFSetField (priv->tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-            bits_per_sample = 8;
-            break;
-        case UFO_BUFFER_DEPTH_16U:
-        case UFO_BUFFER_DEPTH_16S:
-            TIFFSetField (priv->tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-            bits_per_sample = 16;
-            break;
-        default:
-            TIFFSetField (priv->tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
-            bits_per_sample = 32;
-    }
+    write_directory (priv, image, n_levels);
 
-    TIFFSetField (priv->tiff, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
-    ufo_writer_convert_inplace (data, requisition, depth);
-    stride = requisition->dims[0] * bits_per_sample / 8;
-    buff = (gchar *) data;
+    /* Reduced images become the sub directories of the page */
+    for (guint i = 0; i < n_levels; i++) {
+        UfoWriterImage level_image = *image;
 
-    for (guint y = 0; y < requisition->dims[1]; y++) {
-        TIFFWriteScanline (priv->tiff, buff, y, 0);
-        buff += stride;
+        level_image.data = priv->levels[i].data;
+        level_image.requisition = &priv->levels[i].requisition;
+        TIFFSetField (priv->tiff, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+        write_directory (priv, &level_image, 0);
     }
 
-    TIFFWriteDirectory (priv->tiff);
     priv->page++;
 }
 
+static void
+ufo_tiff_writer_write_many (UfoWriter *writer,
+                            UfoWriterImage *image,
+                            guint n_frames,
+                            gsize stride)
+{
+    UfoTiffWriterPrivate *priv;
+
+    priv = UFO_TIFF_WRITER_GET_PRIVATE (writer);
+    g_assert (priv->tiff != NULL);
+
+#ifdef HAVE_ZLIB
+    /*
+     * With deflate, strips of all frames are compressed at once and the pages
+     * are then stored one after the other.
+     */
+    if (priv->compression == COMPRESSION_ADOBE_DEFLATE && priv->n_levels == 0) {
+        gsize frame_size;
+        gsize strip_size;
+        guint strips_per_frame;
+
+        frame_size = ufo_writer_convert_many (image, n_frames, stride);
+        strip_size = get_rows_per_strip (image) * (frame_size / image->requisition->dims[1]);
+        strips_per_frame = (guint) ((frame_size + strip_size - 1) / strip_size);
+        compress_strips (priv, image->data, n_frames, frame_size, strip_size);
+
+        for (guint i = 0; i < n_frames; i++) {
+            TIFFSetField (priv->tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+            TIFFSetField (priv->tiff, TIFFTAG_PAGENUMBER, priv->page, priv->page);
+            set_fields (priv, image, 0);
+            write_raw_strips (priv, i * strips_per_frame, strips_per_frame);
+            TIFFWriteDirectory (priv->tiff);
+            priv->page++;
+        }
+
+        return;
+    }
+#endif
+
+    for (guint i = 0; i < n_frames; i++) {
+        UfoWriterImage frame = *image;
+
+        frame.data = ((guint8 *) image->data) + i * stride;
+        ufo_tiff_writer_write (writer, &frame);
+    }
+}
+
 static void
 ufo_tiff_writer_finalize (GObject *object)
 {
@@ -138,6 +452,10 @@ ufo_tiff_writer_finalize (GObject *object)
     if (priv->tiff != NULL)
         ufo_tiff_writer_close (UFO_WRITER (object));
 
+    g_free (priv->strips);
+    g_free (priv->strip_sizes);
+    g_free (priv->pixels);
+
     G_OBJECT_CLASS (ufo_tiff_writer_parent_class)->finalize (object);
 }
 
@@ -148,6 +466,7 @@ ufo_writer_interface_init (UfoWriterIface *iface)
     iface->open = ufo_tiff_writer_open;
     iface->close = ufo_tiff_writer_close;
     iface->write = ufo_tiff_writer_write;
+    iface->write_many = ufo_tiff_writer_write_many;
 }
 
 static void
@@ -167,4 +486,13 @@ ufo_tiff_writer_init (UfoTiffWriter *self)
 
     self->priv = priv = UFO_TIFF_WRITER_GET_PRIVATE (self);
     priv->tiff = NULL;
+    priv->bigtiff = FALSE;
+    priv->compression = COMPRESSION_NONE;
+    priv->n_levels = 0;
+    priv->pixels = NULL;
+    priv->strips = NULL;
+    priv->strip_sizes = NULL;
+    priv->strip_capacity = 0;
+    priv->strip_bound = 0;
+    priv->n_strips = 0;
 }
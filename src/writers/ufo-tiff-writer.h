@@ -46,8 +46,14 @@ struct _UfoTiffWriterClass {
     GObjectClass parent_class;
 };
 
-UfoTiffWriter  *ufo_tiff_writer_new       (void);
-GType           ufo_tiff_writer_get_type  (void);
+UfoTiffWriter  *ufo_tiff_writer_new             (void);
+void            ufo_tiff_writer_set_bigtiff     (UfoTiffWriter *writer,
+                                                 gboolean       bigtiff);
+gboolean        ufo_tiff_writer_set_compression (UfoTiffWriter *writer,
+                                                 const gchar   *compression);
+void            ufo_tiff_writer_set_levels      (UfoTiffWriter *writer,
+                                                 guint          n_levels);
+GType           ufo_tiff_writer_get_type        (void);
 
 G_END_DECLS
 
@@ -17,8 +17,15 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "ufo-writer.h"
 
+/* Number of samples handled by one OpenMP work item */
+#define BLOCK_SIZE 16384
+
 typedef UfoWriterIface UfoWriterInterface;
 
 G_DEFINE_INTERFACE (UfoWriter, ufo_writer, 0)
@@ -45,11 +52,40 @@ ufo_writer_close (UfoWriter *writer)
 
 void
 ufo_writer_write (UfoWriter *writer,
-                  gpointer data,
-                  UfoRequisition *requisition,
-                  UfoBufferDepth depth)
+                  UfoWriterImage *image)
+{
+    UFO_WRITER_GET_IFACE (writer)->write (writer, image);
+}
+
+/**
+ * ufo_writer_write_many:
+ * @writer: A #UfoWriter
+ * @image: First frame, its requisition describes a single frame
+ * @n_frames: Number of frames
+ * @stride: Distance between consecutive frames in bytes
+ *
+ * Write @n_frames consecutive frames. Writers that do not implement
+ * write_many get one write call per frame.
+ */
+void
+ufo_writer_write_many (UfoWriter *writer,
+                       UfoWriterImage *image,
+                       guint n_frames,
+                       gsize stride)
 {
-    UFO_WRITER_GET_IFACE (writer)->write (writer, data, requisition, depth);
+    UfoWriterIface *iface = UFO_WRITER_GET_IFACE (writer);
+
+    if (iface->write_many != NULL) {
+        iface->write_many (writer, image, n_frames, stride);
+        return;
+    }
+
+    for (guint i = 0; i < n_frames; i++) {
+        UfoWriterImage frame = *image;
+
+        frame.data = ((guint8 *) image->data) + i * stride;
+        iface->write (writer, &frame);
+    }
 }
 
 static gsize
@@ -63,92 +99,343 @@ get_num_elements (UfoRequisition *requisition)
     return count;
 }
 
-static void
-get_min_max (gfloat *data, UfoRequisition *requisition, gfloat *min, gfloat *max)
+static gsize
+get_bytes_per_sample (UfoBufferDepth depth)
+{
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            return 1;
+        case UFO_BUFFER_DEPTH_16U:
+        case UFO_BUFFER_DEPTH_16S:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+/**
+ * ufo_writer_get_min_max:
+ * @data: Float samples
+ * @requisition: Dimensions of @data
+ * @min: (out): Location for the smallest sample
+ * @max: (out): Location for the largest sample
+ */
+void
+ufo_writer_get_min_max (gfloat *data,
+                        UfoRequisition *requisition,
+                        gfloat *min,
+                        gfloat *max)
 {
     gsize n_elements = get_num_elements (requisition);
+    glong n_blocks = (glong) ((n_elements + BLOCK_SIZE - 1) / BLOCK_SIZE);
     gfloat cmax = -G_MAXFLOAT;
     gfloat cmin = G_MAXFLOAT;
 
-    for (gsize i = 0; i < n_elements; i++) {
-        if (data[i] < cmin)
-            cmin = data[i];
+#pragma omp parallel for reduction(min:cmin) reduction(max:cmax)
+    for (glong b = 0; b < n_blocks; b++) {
+        gsize i = (gsize) b * BLOCK_SIZE;
+        gsize end = MIN (i + BLOCK_SIZE, n_elements);
+#ifdef __SSE2__
+        __m128 vmin = _mm_set1_ps (G_MAXFLOAT);
+        __m128 vmax = _mm_set1_ps (-G_MAXFLOAT);
+        gfloat lanes_min[4];
+        gfloat lanes_max[4];
+
+        for (; i + 4 <= end; i += 4) {
+            __m128 v = _mm_loadu_ps (data + i);
+            /* Both return the second operand for NaN, which skips it */
+            vmin = _mm_min_ps (v, vmin);
+            vmax = _mm_max_ps (v, vmax);
+        }
+
+        _mm_storeu_ps (lanes_min, vmin);
+        _mm_storeu_ps (lanes_max, vmax);
+
+        for (guint k = 0; k < 4; k++) {
+            if (lanes_min[k] < cmin)
+                cmin = lanes_min[k];
+
+            if (lanes_max[k] > cmax)
+                cmax = lanes_max[k];
+        }
+#endif
+
+        for (; i < end; i++) {
+            if (data[i] < cmin)
+                cmin = data[i];
 
-        if (data[i] > cmax)
-            cmax = data[i];
+            if (data[i] > cmax)
+                cmax = data[i];
+        }
     }
 
     *max = cmax;
     *min = cmin;
 }
 
-static void
-convert_to_8bit (gfloat *src, UfoRequisition *requisition)
+static inline gfloat
+scale_sample (gfloat value, gfloat min, gfloat scale, gfloat limit)
 {
-    guint8 *dst;
-    gfloat max, min;
-    gsize n_elements;
+    gfloat v = (value - min) * scale;
+
+    /* Also maps NaN to zero */
+    if (!(v > 0.0f))
+        return 0.0f;
+
+    return v > limit ? limit : v;
+}
+
+#ifdef __SSE2__
+static inline __m128i
+scale_samples (const gfloat *src, __m128 vmin, __m128 vscale, __m128 vlimit)
+{
+    __m128 v = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (src), vmin), vscale);
+
+    /* _mm_max_ps returns the second operand for NaN */
+    v = _mm_min_ps (_mm_max_ps (v, _mm_setzero_ps ()), vlimit);
+    return _mm_cvttps_epi32 (v);
+}
+#endif
 
-    get_min_max (src, requisition, &min, &max);
-    n_elements = get_num_elements (requisition);
-    dst = (guint8 *) src;
+static void
+quantize_8 (const gfloat *src, guint8 *dst, gsize n_elements, gfloat min, gfloat scale)
+{
+    gsize i = 0;
+#ifdef __SSE2__
+    __m128 vmin = _mm_set1_ps (min);
+    __m128 vscale = _mm_set1_ps (scale);
+    __m128 vlimit = _mm_set1_ps (255.0f);
 
-    if (min >= 0.0 && max <= 255) {
-        for (gsize i = 0; i < n_elements; i++)
-            dst[i] = (guint16) src[i];
+    for (; i + 16 <= n_elements; i += 16) {
+        __m128i lo = _mm_packs_epi32 (scale_samples (src + i, vmin, vscale, vlimit),
+                                      scale_samples (src + i + 4, vmin, vscale, vlimit));
+        __m128i hi = _mm_packs_epi32 (scale_samples (src + i + 8, vmin, vscale, vlimit),
+                                      scale_samples (src + i + 12, vmin, vscale, vlimit));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
     }
-    else {
-        gfloat range = max - min;
+#endif
+    for (; i < n_elements; i++)
+        dst[i] = (guint8) scale_sample (src[i], min, scale, 255.0f);
+}
+
+/**
+ * ufo_writer_quantize_row:
+ * @src: Float samples
+ * @dst: Location for @n_elements 8-bit samples
+ * @n_elements: Number of samples
+ * @min: Sample mapped to zero
+ * @max: Sample mapped to 255
+ *
+ * Convert a single row to 8 bits on the calling thread, so that writers can
+ * quantize each row right before encoding it.
+ */
+void
+ufo_writer_quantize_row (const gfloat *src,
+                         guint8 *dst,
+                         gsize n_elements,
+                         gfloat min,
+                         gfloat max)
+{
+    quantize_8 (src, dst, n_elements, min, max > min ? 255.0f / (max - min) : 0.0f);
+}
+
+static void
+quantize_16 (const gfloat *src, guint16 *dst, gsize n_elements, gfloat min, gfloat scale)
+{
+    gsize i = 0;
+#ifdef __SSE2__
+    __m128 vmin = _mm_set1_ps (min);
+    __m128 vscale = _mm_set1_ps (scale);
+    __m128 vlimit = _mm_set1_ps (65535.0f);
+    __m128i bias = _mm_set1_epi32 (32768);
+    __m128i sign = _mm_set1_epi16 ((gint16) 0x8000);
 
-        for (gsize i = 0; i < n_elements; i++)
-            dst[i] = (guint16) ((src[i] - min) / range * 255);
+    /* SSE2 can only pack with signed saturation, so shift the range */
+    for (; i + 8 <= n_elements; i += 8) {
+        __m128i lo = _mm_sub_epi32 (scale_samples (src + i, vmin, vscale, vlimit), bias);
+        __m128i hi = _mm_sub_epi32 (scale_samples (src + i + 4, vmin, vscale, vlimit), bias);
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_xor_si128 (_mm_packs_epi32 (lo, hi), sign));
     }
+#endif
+    for (; i < n_elements; i++)
+        dst[i] = (guint16) scale_sample (src[i], min, scale, 65535.0f);
 }
 
+/*
+ * Converts in place. Within a block, samples are read before the narrower
+ * result reaches them. Across blocks, the output of block b lands in the input
+ * of block b / ratio, so blocks run in waves [lo, lo * ratio) that only
+ * overwrite input of earlier waves.
+ */
 static void
-convert_to_16bit (gfloat *src, UfoRequisition *requisition)
+quantize (gfloat *src, gsize n_elements, gfloat min, gfloat max, guint bits)
 {
-    guint16 *dst;
-    gfloat max, min;
-    gsize n_elements;
+    glong n_blocks = (glong) ((n_elements + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    glong ratio = bits == 8 ? 4 : 2;
+    gfloat limit = bits == 8 ? 255.0f : 65535.0f;
+    gfloat scale = max > min ? limit / (max - min) : 0.0f;
+
+#pragma omp parallel
+    {
+        glong lo = 0;
+        glong hi = 1;
+
+        while (lo < n_blocks) {
+            glong end_block = MIN (hi, n_blocks);
 
-    get_min_max (src, requisition, &min, &max);
-    n_elements = get_num_elements (requisition);
-    dst = (guint16 *) src;
+            /* The implicit barrier ends the wave */
+#pragma omp for
+            for (glong b = lo; b < end_block; b++) {
+                gsize i = (gsize) b * BLOCK_SIZE;
+                gsize n = MIN (BLOCK_SIZE, n_elements - i);
 
-    /* TODO: good opportunity for some SSE acceleration */
-    if (min >= 0.0 && max <= 65535) {
-        for (gsize i = 0; i < n_elements; i++)
-            dst[i] = (guint16) src[i];
+                if (bits == 8)
+                    quantize_8 (src + i, ((guint8 *) src) + i, n, min, scale);
+                else
+                    quantize_16 (src + i, ((guint16 *) src) + i, n, min, scale);
+            }
+
+            lo = end_block;
+            hi = lo * ratio;
+        }
     }
-    else {
-        gfloat range = max - min;
+}
 
-        for (gsize i = 0; i < n_elements; i++)
-            dst[i] = (guint16) ((src[i] - min) / range * 65535);
+/**
+ * ufo_writer_downsample:
+ * @src: Float frame
+ * @width: Width of @src
+ * @height: Height of @src
+ * @dst: Frame receiving @width / 2 x @height / 2 samples
+ *
+ * Average 2x2 blocks of @src. An odd last row or column is dropped.
+ */
+void
+ufo_writer_downsample (const gfloat *src,
+                       gsize width,
+                       gsize height,
+                       gfloat *dst)
+{
+    glong dst_height = (glong) (height / 2);
+    gsize dst_width = width / 2;
+
+#pragma omp parallel for
+    for (glong y = 0; y < dst_height; y++) {
+        const gfloat *row0 = src + 2 * y * width;
+        const gfloat *row1 = row0 + width;
+        gfloat *out = dst + y * dst_width;
+        gsize x = 0;
+
+#ifdef __SSE2__
+        __m128 quarter = _mm_set1_ps (0.25f);
+
+        /* Add both rows and then pairs of neighbouring columns */
+        for (; x + 4 <= dst_width; x += 4) {
+            __m128 lo = _mm_add_ps (_mm_loadu_ps (row0 + 2 * x), _mm_loadu_ps (row1 + 2 * x));
+            __m128 hi = _mm_add_ps (_mm_loadu_ps (row0 + 2 * x + 4), _mm_loadu_ps (row1 + 2 * x + 4));
+            __m128 even = _mm_shuffle_ps (lo, hi, _MM_SHUFFLE (2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps (lo, hi, _MM_SHUFFLE (3, 1, 3, 1));
+
+            _mm_storeu_ps (out + x, _mm_mul_ps (_mm_add_ps (even, odd), quarter));
+        }
+#endif
+
+        for (; x < dst_width; x++)
+            out[x] = 0.25f * (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1]);
     }
 }
 
+/**
+ * ufo_writer_convert_inplace:
+ * @image: A #UfoWriterImage with float data
+ *
+ * Convert the float samples of @image to its bit depth. If @image specifies a
+ * range with min smaller than max, samples are mapped from that range,
+ * otherwise from the range of the samples unless they fit the bit depth
+ * already.
+ */
 void
-ufo_writer_convert_inplace (gpointer data,
-                            UfoRequisition *requisition,
-                            UfoBufferDepth depth)
+ufo_writer_convert_inplace (UfoWriterImage *image)
 {
+    gsize n_elements;
+    gfloat min, max;
+    guint bits;
+
+    if (image->quantized)
+        return;
+
     /*
      * Since we convert to data requiring less bytes per pixel than the native
      * float format, we can do everything in-place.
      */
-    switch (depth) {
+    switch (image->depth) {
         case UFO_BUFFER_DEPTH_8U:
-            convert_to_8bit (data, requisition);
+            bits = 8;
             break;
         case UFO_BUFFER_DEPTH_16U:
         case UFO_BUFFER_DEPTH_16S:
-            convert_to_16bit (data, requisition);
+            bits = 16;
             break;
         default:
-            break;
+            return;
+    }
+
+    n_elements = get_num_elements (image->requisition);
+
+    if (image->min < image->max) {
+        min = image->min;
+        max = image->max;
+    }
+    else {
+        gfloat limit = bits == 8 ? 255.0f : 65535.0f;
+
+        ufo_writer_get_min_max (image->data, image->requisition, &min, &max);
+
+        if (min >= 0.0f && max <= limit) {
+            min = 0.0f;
+            max = limit;
+        }
+    }
+
+    quantize (image->data, n_elements, min, max, bits);
+}
+
+/**
+ * ufo_writer_convert_many:
+ * @image: First frame, its requisition describes a single frame
+ * @n_frames: Number of frames
+ * @stride: Distance between consecutive frames in bytes
+ *
+ * Convert each frame like ufo_writer_convert_inplace() and pack the converted
+ * frames densely at the start of the data of @image.
+ *
+ * Returns: Size of a converted frame in bytes.
+ */
+gsize
+ufo_writer_convert_many (UfoWriterImage *image,
+                         guint n_frames,
+                         gsize stride)
+{
+    guint8 *data = image->data;
+    gsize frame_size;
+
+    frame_size = get_num_elements (image->requisition) * get_bytes_per_sample (image->depth);
+
+    for (guint i = 0; i < n_frames; i++) {
+        UfoWriterImage frame = *image;
+
+        frame.data = data + i * stride;
+        ufo_writer_convert_inplace (&frame);
+
+        /*
+         * Converted frames are never larger, so earlier frames stay intact.
+         * Quantized frames are only packed.
+         */
+        if (i > 0 && stride != frame_size)
+            memmove (data + i * frame_size, frame.data, frame_size);
     }
+
+    return frame_size;
 }
 
 static void
@@ -33,6 +33,27 @@ G_BEGIN_DECLS
 typedef struct _UfoWriter         UfoWriter;
 typedef struct _UfoWriterIface    UfoWriterIface;
 
+/**
+ * UfoWriterImage:
+ * @data: Float samples, converted in-place to @depth by the writer
+ * @requisition: Dimensions of @data
+ * @depth: Bit depth of the written samples
+ * @min: Sample mapped to zero when converting
+ * @max: Sample mapped to the largest value of @depth when converting
+ * @quantized: %TRUE if @data already holds samples of @depth, for example
+ *  converted on the device, which are then written as they are
+ *
+ * If @min is not smaller than @max, each image is mapped from its own range.
+ */
+typedef struct {
+    gpointer        data;
+    UfoRequisition *requisition;
+    UfoBufferDepth  depth;
+    gfloat          min;
+    gfloat          max;
+    gboolean        quantized;
+} UfoWriterImage;
+
 
 struct _UfoWriterIface {
     /*< private >*/
@@ -44,9 +65,12 @@ struct _UfoWriterIface {
                           const gchar    *filename);
     void     (*close)    (UfoWriter      *writer);
     void     (*write)    (UfoWriter      *writer,
-                          gpointer        data,
-                          UfoRequisition *requisition,
-                          UfoBufferDepth  depth);
+                          UfoWriterImage *image);
+    void     (*write_many)
+                         (UfoWriter      *writer,
+                          UfoWriterImage *image,
+                          guint           n_frames,
+                          gsize           stride);
 };
 
 gboolean ufo_writer_can_open (UfoWriter      *writer,
@@ -55,13 +79,34 @@ void     ufo_writer_open     (UfoWriter      *writer,
                               const gchar    *filename);
 void     ufo_writer_close    (UfoWriter      *writer);
 void     ufo_writer_write    (UfoWriter      *writer,
-                              gpointer        data,
-                              UfoRequisition *requisition,
-                              UfoBufferDepth  depth);
+                              UfoWriterImage *image);
+void     ufo_writer_write_many
+                             (UfoWriter      *writer,
+                              UfoWriterImage *image,
+                              guint           n_frames,
+                              gsize           stride);
 void     ufo_writer_convert_inplace
-                             (gpointer        data,
+                             (UfoWriterImage *image);
+gsize    ufo_writer_convert_many
+                             (UfoWriterImage *image,
+                              guint           n_frames,
+                              gsize           stride);
+void     ufo_writer_quantize_row
+                             (const gfloat   *src,
+                              guint8         *dst,
+                              gsize           n_elements,
+                              gfloat          min,
+                              gfloat          max);
+void     ufo_writer_downsample
+                             (const gfloat   *src,
+                              gsize           width,
+                              gsize           height,
+                              gfloat         *dst);
+void     ufo_writer_get_min_max
+                             (gfloat         *data,
                               UfoRequisition *requisition,
-                              UfoBufferDepth  depth);
+                              gfloat         *min,
+                              gfloat         *max);
 
 GType  ufo_writer_get_type        (void);
 